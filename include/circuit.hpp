@@ -9,8 +9,25 @@
 #include "circuit_source.hpp"
 #include "circuit_linear.hpp"
 #include "circuit_diode.hpp"
+#include "circuit_diode_bank.hpp"
 #include "circuit_transistor.hpp"
+#include "circuit_macromodel.hpp"
+#include "circuit_iterative.hpp"
+#include "circuit_thread_pool.hpp"
+#include "circuit_parallel_lu.hpp"
+#include "circuit_lane_lu.hpp"
+#include "circuit_blocks.hpp"
 #include "circuit_math.hpp"
+#include "circuit_low_rank.hpp"
+#include "circuit_expint.hpp"
+#include "circuit_newton.hpp"
+#include "circuit_operating_point.hpp"
 #include "circuit_simulator.hpp"
 #include "circuit_parser.hpp"
+#include "circuit_reduction.hpp"
+#include "circuit_topology.hpp"
+#include "circuit_scheduler.hpp"
+#include "circuit_monte_carlo.hpp"
+#include "circuit_shard.hpp"
+#include "circuit_analyses.hpp"
 #endif
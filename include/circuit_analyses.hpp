@@ -0,0 +1,116 @@
+#ifndef GUARD_CIRCUIT_ANALYSES_HPP
+#define GUARD_CIRCUIT_ANALYSES_HPP
+
+#include <thread>
+#include <fstream>
+#include <memory>
+
+// Runs the analyses of a netlist (every .op and .tran line) at the same time,
+// each on its own thread and into its own file. The simulation state lives in
+// the nodes and components, so the first analysis runs on the schematic and
+// every other one on a copy parsed from the netlist, as the workers of a
+// Scheduler do.
+//
+// A transient starts each run from the DC operating point, the same problem a
+// .op analysis of the netlist solves for that run. When both are present the
+// first .op hands its solutions to the transients through an
+// OperatingPoint::Pipeline: the transient of a run starts as soon as the .op
+// analysis has solved it, while the .op analysis goes on with the next runs.
+class Circuit::Analyses
+{
+public:
+    // runs sims[s] of schem into the file at paths[s]
+    static void run(Schematic *schem, const std::vector<std::string> &paths, Simulator::OutputFormat format);
+};
+
+void Circuit::Analyses::run(Schematic *schem, const std::vector<std::string> &paths, Simulator::OutputFormat format)
+{
+    const size_t N = schem->sims.size();
+    const size_t available = schem->getOption("threads", std::thread::hardware_concurrency());
+    if (N < 2 || available <= 1)
+    {
+        for (size_t s = 0; s < N; s++)
+        {
+            std::ofstream out(paths[s]);
+            schem->sims[s]->run(out, format);
+        }
+        return;
+    }
+
+    std::vector<Schematic *> copies;
+    std::vector<Simulator *> sims(N);
+    for (size_t s = 0; s < N; s++)
+    {
+        if (s == 0)
+        {
+            sims[s] = schem->sims[s];
+        }
+        else
+        {
+            copies.push_back(Scheduler::replicate(schem));
+            sims[s] = copies.back()->sims[s];
+        }
+    }
+    // the analyses share the machine, so each takes its part of the threads
+    // for the workers of its sweep and for its solves, as shards do
+    const size_t share = std::max<size_t>(1, available / N);
+    const std::map<std::string, double> options = schem->options;
+    schem->options["threads"] = share;
+    for (Schematic *copy : copies)
+    {
+        copy->options["threads"] = share;
+    }
+
+    std::unique_ptr<OperatingPoint::Pipeline> pipeline;
+    const size_t source = std::find_if(sims.begin(), sims.end(), [](Simulator *sim) { return sim->type == Simulator::OP; }) - sims.begin();
+    const size_t reporter = std::find_if(sims.begin(), sims.end(), [](Simulator *sim) { return sim->type == Simulator::TRAN; }) - sims.begin();
+    if (source < N && reporter < N)
+    {
+        pipeline.reset(new OperatingPoint::Pipeline(schem->sweep.size()));
+        sims[source]->publishing = pipeline.get();
+        for (Simulator *sim : sims)
+        {
+            if (sim->type == Simulator::TRAN)
+            {
+                sim->seeding = pipeline.get();
+            }
+        }
+    }
+    // a single progress bar, that of the first transient
+    for (size_t s = 0; s < N; s++)
+    {
+        sims[s]->setQuiet(s != (reporter < N ? reporter : 0));
+    }
+
+    auto analysis = [&](size_t s) {
+        Math::setThreadLimit(share);
+        std::ofstream out(paths[s]);
+        sims[s]->run(out, format);
+        if (sims[s]->publishing)
+        {
+            sims[s]->publishing->close();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t s = 1; s < N; s++)
+    {
+        threads.emplace_back(analysis, s);
+    }
+    analysis(0);
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+
+    sims[0]->publishing = nullptr;
+    sims[0]->seeding = nullptr;
+    sims[0]->setQuiet(false);
+    schem->options = options;
+    Math::setThreadLimit(0);
+    for (Schematic *copy : copies)
+    {
+        delete copy;
+    }
+}
+
+#endif
@@ -0,0 +1,719 @@
+#ifndef GUARD_CIRCUIT_BLOCKS_HPP
+#define GUARD_CIRCUIT_BLOCKS_HPP
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+// Sparse solver that splits the matrix into its block triangular form. The
+// diagonal blocks are the strongly connected components of the matrix graph
+// (row i depends on x_j when A(i, j) != 0), so electrically separate islands
+// and nodes pinned by grounded voltage sources end up in blocks of their own.
+// Blocks are factorised separately and solved in dependency order; blocks of
+// the same level do not depend on each other and are spread over threads.
+//
+// The decomposition is redone only when the sparsity pattern changes.
+//
+// Each block is solved with SparseLU or, above a size threshold or when forced,
+// with the preconditioned Krylov methods of IterativeSolver, warm started from
+// the block's previous solution. A Krylov solve that does not converge falls
+// back to the direct one. Direct solves of large blocks are themselves spread
+// over the threads by ParallelLU, with SparseLU as the fallback.
+//
+// Direct solves run on the equilibrated matrix R A C, where R and C are the
+// powers of two nearest to the inverse row and then column maxima. The
+// conductances of one netlist span up to 26 decades (1e-13 for an inductor,
+// 1e13 for a capacitor at t = 0), and the voltage source rows are plain 1 and
+// -1, so without scaling the pivot threshold compares entries of unrelated
+// magnitude. Powers of two scale exactly. The fill-reducing COLAMD ordering
+// is computed once per sparsity pattern and kept for as long as the pattern
+// is, across timesteps and .step runs.
+//
+// With mixed precision on, direct solves factorise the equilibrated matrix in
+// single precision, which halves the memory traffic of the factorisation and
+// the triangular solves, and recover double accuracy by iterative refinement.
+class Circuit::BlockSolver
+{
+public:
+    enum Method
+    {
+        Auto,
+        Direct,
+        Iterative
+    };
+
+private:
+    typedef Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::COLAMDOrdering<int>> LU;
+    typedef Eigen::SparseLU<Eigen::SparseMatrix<float>, Eigen::COLAMDOrdering<int>> SingleLU;
+
+    // mixed precision: relative residual at which refinement stops, and the
+    // refinement steps allowed before the double factorisation takes over
+    static constexpr double REFINE_TOL = 1e-13;
+    static constexpr int MAX_REFINEMENTS = 10;
+
+    // direct and iterative factorisations of one matrix. The direct ones are
+    // kept until the values change, so a fixed step linear transient
+    // factorises once and then only runs triangular solves.
+    struct Factor
+    {
+        LU lu;
+        bool analyzed = false;
+        bool factored = false;
+        std::unique_ptr<IterativeSolver> iterative;
+        std::unique_ptr<ParallelLU> parallel;
+        bool parallelFactored = false;
+        std::vector<double> values; // of the matrix the factors are for
+        Eigen::SparseMatrix<double> scaled;
+        Eigen::VectorXd rowScale;
+        Eigen::VectorXd colScale;
+        Eigen::VectorXd scaledRhs;
+
+        std::unique_ptr<SingleLU> single; // analysed, freed when refinement fails
+        Eigen::SparseMatrix<float> singleMatrix;
+        bool singleFactored = false;
+        bool singleFailed = false; // refinement gave up on these values
+        Eigen::VectorXd residual;
+        Eigen::VectorXf residualSingle;
+        Eigen::VectorXf correction;
+    };
+
+    struct Block
+    {
+        std::vector<int> index; // global row/column of each local one
+        Eigen::SparseMatrix<double> A;
+        std::vector<std::pair<int, int>> values; // (global value, local value) pairs
+        std::vector<std::pair<int, int>> coupling; // (global value, local row) of entries left of the block
+        std::vector<int> couplingCols;
+        Eigen::VectorXd rhs;
+        Eigen::VectorXd x;
+        Factor factor;
+    };
+
+    // blocks this large are worth handing to another thread
+    static constexpr int PARALLEL_MIN_SIZE = 64;
+
+    std::vector<int> outerPattern;
+    std::vector<int> innerPattern;
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::vector<std::vector<Block *>> levels;
+    Factor whole;
+    Eigen::VectorXd wholeX;
+    Eigen::VectorXd column; // one right hand side of a multi column solve
+    Eigen::VectorXd columnX;
+    ThreadPool pool; // shared by the levels and the ParallelLU leaves
+    bool split = false;
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    Method method = Auto;
+    int iterativeMinSize = 20000;
+    int parallelMinSize = 5000;
+    double iterativeTol = 1e-10;
+    bool warnedFallback = false;
+    bool warnedParallel = false;
+    bool equilibrate = true;
+    bool mixedPrecision = false;
+
+    bool samePattern(const Eigen::SparseMatrix<double> &A) const
+    {
+        return A.cols() + 1 == (int)outerPattern.size() &&
+               std::equal(A.outerIndexPtr(), A.outerIndexPtr() + A.cols() + 1, outerPattern.begin()) &&
+               std::equal(A.innerIndexPtr(), A.innerIndexPtr() + A.nonZeros(), innerPattern.begin());
+    }
+
+    void prepare(Factor &f, int size)
+    {
+        f.analyzed = false;
+        f.factored = false;
+        f.single.reset();
+        f.singleFactored = false;
+        f.singleFailed = false;
+        f.parallelFactored = false;
+        f.values.clear();
+        f.iterative.reset();
+        f.parallel.reset();
+        if (size > 1 && (method == Iterative || (method == Auto && size >= iterativeMinSize)))
+        {
+            f.iterative.reset(new IterativeSolver);
+            f.iterative->tolerance = iterativeTol;
+        }
+        else if (threads > 1 && size >= parallelMinSize)
+        {
+            f.parallel.reset(new ParallelLU(pool, threads));
+        }
+    }
+
+    // power of two that brings a row or column maximum into [0.5, 1)
+    static double scaleFor(double maximum)
+    {
+        if (!(maximum > 0) || !std::isfinite(maximum))
+        {
+            return 1.0;
+        }
+        int exponent;
+        std::frexp(maximum, &exponent);
+        return std::ldexp(1.0, -exponent);
+    }
+
+    static void equilibrateInto(Factor &f, const Eigen::SparseMatrix<double> &A);
+    void updateValues(Factor &f, const Eigen::SparseMatrix<double> &A);
+    static bool refine(Factor &f, const Eigen::SparseMatrix<double> &A, const Eigen::VectorXd &rhs, Eigen::VectorXd &x);
+    static void factorize(Factor &f, const Eigen::SparseMatrix<double> &M);
+    void factorSolve(Factor &f, const Eigen::SparseMatrix<double> &A, const Eigen::VectorXd &rhs, Eigen::VectorXd &x);
+    void factorSolve(Factor &f, const Eigen::SparseMatrix<double> &A, const Eigen::MatrixXd &rhs, Eigen::MatrixXd &x);
+    void analyze(const Eigen::SparseMatrix<double> &A);
+    static std::vector<std::vector<int>> stronglyConnected(const Eigen::SparseMatrix<double> &A);
+    void solveBlock(Block &b, const Eigen::SparseMatrix<double> &A, const Eigen::VectorXd &current, Eigen::VectorXd &voltage);
+
+public:
+    void setThreads(unsigned int n)
+    {
+        threads = std::max(1u, n);
+    }
+
+    unsigned int getThreads() const
+    {
+        return threads;
+    }
+
+    void setMethod(Method m, double tol, int minSize, int parallelSize)
+    {
+        method = m;
+        iterativeTol = tol;
+        iterativeMinSize = minSize;
+        parallelMinSize = parallelSize;
+        outerPattern.clear(); // choose the backends again on the next solve
+    }
+
+    void setEquilibration(bool on)
+    {
+        equilibrate = on;
+    }
+
+    // factorise in single precision and refine against the double matrix
+    void setMixedPrecision(bool on)
+    {
+        mixedPrecision = on;
+    }
+
+    // takes the backend settings of other, keeping nothing it has factorised
+    void setSettings(const BlockSolver &other)
+    {
+        setThreads(other.threads);
+        setMethod(other.method, other.iterativeTol, other.iterativeMinSize, other.parallelMinSize);
+        setEquilibration(other.equilibrate);
+        setMixedPrecision(other.mixedPrecision);
+    }
+
+    size_t blockCount() const
+    {
+        return split ? blocks.size() : 1;
+    }
+
+    // A must be compressed
+    void solve(const Eigen::SparseMatrix<double> &A, const Eigen::VectorXd &current, Eigen::VectorXd &voltage);
+    // every column of current against the one matrix A, factorised once
+    void solve(const Eigen::SparseMatrix<double> &A, const Eigen::MatrixXd &current, Eigen::MatrixXd &voltage);
+};
+
+// Tarjan's algorithm without recursion. Components come out sinks first, which
+// is the order the block triangular solve needs.
+std::vector<std::vector<int>> Circuit::BlockSolver::stronglyConnected(const Eigen::SparseMatrix<double> &A)
+{
+    const int n = A.rows();
+    Eigen::SparseMatrix<double, Eigen::RowMajor> rows(A);
+    std::vector<int> order(n, -1);
+    std::vector<int> low(n, 0);
+    std::vector<bool> onStack(n, false);
+    std::vector<int> stack;
+    std::vector<std::pair<int, int>> callStack; // (vertex, next edge)
+    std::vector<std::vector<int>> components;
+    int counter = 0;
+
+    for (int root = 0; root < n; root++)
+    {
+        if (order[root] != -1)
+        {
+            continue;
+        }
+        callStack.emplace_back(root, rows.outerIndexPtr()[root]);
+        order[root] = low[root] = counter++;
+        stack.push_back(root);
+        onStack[root] = true;
+        while (!callStack.empty())
+        {
+            int v = callStack.back().first;
+            int &edge = callStack.back().second;
+            if (edge < rows.outerIndexPtr()[v + 1])
+            {
+                int w = rows.innerIndexPtr()[edge++];
+                if (order[w] == -1)
+                {
+                    order[w] = low[w] = counter++;
+                    stack.push_back(w);
+                    onStack[w] = true;
+                    callStack.emplace_back(w, rows.outerIndexPtr()[w]);
+                }
+                else if (onStack[w])
+                {
+                    low[v] = std::min(low[v], order[w]);
+                }
+                continue;
+            }
+            callStack.pop_back();
+            if (!callStack.empty())
+            {
+                int parent = callStack.back().first;
+                low[parent] = std::min(low[parent], low[v]);
+            }
+            if (low[v] == order[v])
+            {
+                std::vector<int> component;
+                int w;
+                do
+                {
+                    w = stack.back();
+                    stack.pop_back();
+                    onStack[w] = false;
+                    component.push_back(w);
+                } while (w != v);
+                std::sort(component.begin(), component.end());
+                components.push_back(component);
+            }
+        }
+    }
+    return components;
+}
+
+void Circuit::BlockSolver::analyze(const Eigen::SparseMatrix<double> &A)
+{
+    outerPattern.assign(A.outerIndexPtr(), A.outerIndexPtr() + A.cols() + 1);
+    innerPattern.assign(A.innerIndexPtr(), A.innerIndexPtr() + A.nonZeros());
+    blocks.clear();
+    levels.clear();
+
+    // the SCCs only give the block triangular form with a zero free diagonal,
+    // which the row replacement used for voltage sources keeps in practice
+    bool zeroFreeDiagonal = true;
+    for (int j = 0; j < A.cols() && zeroFreeDiagonal; j++)
+    {
+        const int *begin = A.innerIndexPtr() + A.outerIndexPtr()[j];
+        const int *end = A.innerIndexPtr() + A.outerIndexPtr()[j + 1];
+        zeroFreeDiagonal = std::binary_search(begin, end, j);
+    }
+    std::vector<std::vector<int>> components;
+    if (zeroFreeDiagonal)
+    {
+        components = stronglyConnected(A);
+    }
+    split = components.size() > 1;
+    if (!split)
+    {
+        prepare(whole, A.rows());
+        return;
+    }
+
+    const int n = A.rows();
+    std::vector<int> blockOf(n);
+    std::vector<int> local(n);
+    for (size_t k = 0; k < components.size(); k++)
+    {
+        for (size_t i = 0; i < components[k].size(); i++)
+        {
+            blockOf[components[k][i]] = k;
+            local[components[k][i]] = i;
+        }
+    }
+
+    std::vector<std::vector<Eigen::Triplet<double>>> triplets(components.size());
+    for (size_t k = 0; k < components.size(); k++)
+    {
+        blocks.emplace_back(new Block);
+        blocks[k]->index = components[k];
+    }
+    for (int j = 0; j < A.cols(); j++)
+    {
+        for (int p = A.outerIndexPtr()[j]; p < A.outerIndexPtr()[j + 1]; p++)
+        {
+            int i = A.innerIndexPtr()[p];
+            Block &b = *blocks[blockOf[i]];
+            if (blockOf[i] == blockOf[j])
+            {
+                triplets[blockOf[i]].emplace_back(local[i], local[j], 1.0);
+            }
+            else
+            {
+                b.coupling.emplace_back(p, local[i]);
+                b.couplingCols.push_back(j);
+            }
+        }
+    }
+
+    std::vector<int> level(components.size(), 0);
+    for (size_t k = 0; k < components.size(); k++)
+    {
+        Block &b = *blocks[k];
+        const int size = b.index.size();
+        b.A.resize(size, size);
+        b.A.setFromTriplets(triplets[k].begin(), triplets[k].end());
+        b.A.makeCompressed();
+        b.rhs.resize(size);
+        b.x = Eigen::VectorXd::Zero(size);
+        prepare(b.factor, size);
+
+        // where every in-block global value lands in the block's storage
+        for (int j : b.index)
+        {
+            for (int p = A.outerIndexPtr()[j]; p < A.outerIndexPtr()[j + 1]; p++)
+            {
+                int i = A.innerIndexPtr()[p];
+                if (blockOf[i] == (int)k)
+                {
+                    const int lj = local[j];
+                    const int *begin = b.A.innerIndexPtr() + b.A.outerIndexPtr()[lj];
+                    const int *end = b.A.innerIndexPtr() + b.A.outerIndexPtr()[lj + 1];
+                    b.values.emplace_back(p, std::lower_bound(begin, end, local[i]) - b.A.innerIndexPtr());
+                }
+            }
+        }
+
+        // a block can be solved once every block it couples to is
+        for (int j : b.couplingCols)
+        {
+            level[k] = std::max(level[k], level[blockOf[j]] + 1);
+        }
+        if (level[k] >= (int)levels.size())
+        {
+            levels.resize(level[k] + 1);
+        }
+        levels[level[k]].push_back(&b);
+    }
+}
+
+void Circuit::BlockSolver::equilibrateInto(Factor &f, const Eigen::SparseMatrix<double> &A)
+{
+    const int n = A.rows();
+    f.rowScale.setZero(n);
+    f.colScale.setZero(n);
+    for (int j = 0; j < n; j++)
+    {
+        for (int p = A.outerIndexPtr()[j]; p < A.outerIndexPtr()[j + 1]; p++)
+        {
+            double &r = f.rowScale[A.innerIndexPtr()[p]];
+            r = std::max(r, std::abs(A.valuePtr()[p]));
+        }
+    }
+    for (int i = 0; i < n; i++)
+    {
+        f.rowScale[i] = scaleFor(f.rowScale[i]);
+    }
+    for (int j = 0; j < n; j++)
+    {
+        for (int p = A.outerIndexPtr()[j]; p < A.outerIndexPtr()[j + 1]; p++)
+        {
+            f.colScale[j] = std::max(f.colScale[j], std::abs(A.valuePtr()[p]) * f.rowScale[A.innerIndexPtr()[p]]);
+        }
+        f.colScale[j] = scaleFor(f.colScale[j]);
+    }
+    f.scaled = A;
+    for (int j = 0; j < n; j++)
+    {
+        for (int p = A.outerIndexPtr()[j]; p < A.outerIndexPtr()[j + 1]; p++)
+        {
+            f.scaled.valuePtr()[p] *= f.rowScale[A.innerIndexPtr()[p]] * f.colScale[j];
+        }
+    }
+}
+
+// drops the factors of f if the values of A are not the ones they were
+// computed for
+void Circuit::BlockSolver::updateValues(Factor &f, const Eigen::SparseMatrix<double> &A)
+{
+    if (!(f.values.size() == (size_t)A.nonZeros() && std::equal(f.values.begin(), f.values.end(), A.valuePtr())))
+    {
+        f.values.assign(A.valuePtr(), A.valuePtr() + A.nonZeros());
+        f.factored = false;
+        f.singleFactored = false;
+        f.singleFailed = false;
+        f.parallelFactored = false;
+        if (equilibrate)
+        {
+            equilibrateInto(f, A);
+        }
+    }
+}
+
+void Circuit::BlockSolver::factorSolve(Factor &f, const Eigen::SparseMatrix<double> &A, const Eigen::VectorXd &rhs, Eigen::VectorXd &x)
+{
+    if (f.iterative)
+    {
+        if (f.iterative->compute(A) && f.iterative->solve(rhs, x))
+        {
+            return;
+        }
+        if (!warnedFallback)
+        {
+            std::cerr << "iterative solver did not converge, using SparseLU" << std::endl;
+            warnedFallback = true;
+        }
+    }
+
+    updateValues(f, A);
+
+    // solves R A C y = R b for x = C y
+    const Eigen::SparseMatrix<double> *M = &A;
+    const Eigen::VectorXd *b = &rhs;
+    if (equilibrate)
+    {
+        f.scaledRhs = f.rowScale.cwiseProduct(rhs);
+        M = &f.scaled;
+        b = &f.scaledRhs;
+    }
+    bool solved = false;
+    if (f.parallel)
+    {
+        if (!f.parallelFactored)
+        {
+            f.parallelFactored = f.parallel->compute(*M);
+        }
+        solved = f.parallelFactored && f.parallel->solve(*b, x);
+        if (!solved)
+        {
+            if (!warnedParallel)
+            {
+                std::cerr << "parallel LU failed, using SparseLU" << std::endl;
+                warnedParallel = true;
+            }
+            f.parallel.reset();
+        }
+    }
+    if (!solved && mixedPrecision && !f.singleFailed)
+    {
+        if (!f.singleFactored)
+        {
+            f.singleMatrix = M->cast<float>();
+            if (!f.single)
+            {
+                f.single.reset(new SingleLU);
+                f.single->analyzePattern(f.singleMatrix);
+            }
+            f.single->factorize(f.singleMatrix);
+            f.singleFactored = f.single->info() == Eigen::Success;
+        }
+        solved = f.singleFactored && refine(f, *M, *b, x);
+        if (!solved)
+        {
+            // the double factors take every solve until the values change,
+            // so the single ones would only hold memory
+            f.singleFailed = true;
+            f.singleFactored = false;
+            f.single.reset();
+            f.singleMatrix = Eigen::SparseMatrix<float>();
+        }
+    }
+    if (!solved)
+    {
+        if (!f.factored)
+        {
+            factorize(f, *M);
+        }
+        x = f.lu.solve(*b);
+    }
+    if (equilibrate)
+    {
+        x.array() *= f.colScale.array();
+    }
+}
+
+// SparseLU only reports a singular matrix through info(), its solve would go on
+// with the broken factors, so this throws for the caller to skip the solve.
+void Circuit::BlockSolver::factorize(Factor &f, const Eigen::SparseMatrix<double> &M)
+{
+    if (!f.analyzed)
+    {
+        f.lu.analyzePattern(M);
+        f.analyzed = true;
+    }
+    f.lu.factorize(M);
+    if (f.lu.info() != Eigen::Success)
+    {
+        throw std::runtime_error("SparseLU failed: " + f.lu.lastErrorMessage());
+    }
+    f.factored = true;
+}
+
+// Direct solve of all columns at once, so the supernodal triangular solves run
+// as dense matrix-matrix products. Only for the double SparseLU backend.
+void Circuit::BlockSolver::factorSolve(Factor &f, const Eigen::SparseMatrix<double> &A, const Eigen::MatrixXd &rhs, Eigen::MatrixXd &x)
+{
+    updateValues(f, A);
+    const Eigen::SparseMatrix<double> &M = equilibrate ? f.scaled : A;
+    if (!f.factored)
+    {
+        factorize(f, M);
+    }
+    if (equilibrate)
+    {
+        x = f.lu.solve(f.rowScale.asDiagonal() * rhs);
+        x = f.colScale.asDiagonal() * x;
+    }
+    else
+    {
+        x = f.lu.solve(rhs);
+    }
+}
+
+// Classic iterative refinement: the correction is solved with the single
+// precision factors and the residual is formed against the double matrix, so
+// each step gains about -log10(cond(A) * 6e-8) digits. Gives up, leaving the
+// solve to the double factors, when the residual stops halving.
+bool Circuit::BlockSolver::refine(Factor &f, const Eigen::SparseMatrix<double> &A, const Eigen::VectorXd &rhs, Eigen::VectorXd &x)
+{
+    const double target = REFINE_TOL * rhs.norm();
+    double last = std::numeric_limits<double>::infinity();
+    x.setZero(rhs.size());
+    f.residual = rhs;
+    for (int k = 0; k < MAX_REFINEMENTS; k++)
+    {
+        f.residualSingle = f.residual.cast<float>();
+        f.correction = f.single->solve(f.residualSingle);
+        x += f.correction.cast<double>();
+        f.residual = rhs;
+        f.residual.noalias() -= A * x;
+        const double norm = f.residual.norm();
+        if (norm <= target)
+        {
+            return true;
+        }
+        if (!(norm < 0.5 * last))
+        {
+            return false;
+        }
+        last = norm;
+    }
+    return false;
+}
+
+void Circuit::BlockSolver::solveBlock(Block &b, const Eigen::SparseMatrix<double> &A, const Eigen::VectorXd &current, Eigen::VectorXd &voltage)
+{
+    for (const std::pair<int, int> &v : b.values)
+    {
+        b.A.valuePtr()[v.second] = A.valuePtr()[v.first];
+    }
+    for (size_t i = 0; i < b.index.size(); i++)
+    {
+        b.rhs[i] = current[b.index[i]];
+    }
+    for (size_t c = 0; c < b.coupling.size(); c++)
+    {
+        b.rhs[b.coupling[c].second] -= A.valuePtr()[b.coupling[c].first] * voltage[b.couplingCols[c]];
+    }
+    if (b.index.size() == 1)
+    {
+        if (b.A.nonZeros() == 0 || b.A.valuePtr()[0] == 0)
+        {
+            throw std::runtime_error("zero pivot in a 1x1 block");
+        }
+        b.x[0] = b.rhs[0] / b.A.valuePtr()[0];
+    }
+    else
+    {
+        factorSolve(b.factor, b.A, b.rhs, b.x);
+    }
+    for (size_t i = 0; i < b.index.size(); i++)
+    {
+        voltage[b.index[i]] = b.x[i];
+    }
+}
+
+void Circuit::BlockSolver::solve(const Eigen::SparseMatrix<double> &A, const Eigen::VectorXd &current, Eigen::VectorXd &voltage)
+{
+    if (!samePattern(A))
+    {
+        analyze(A);
+    }
+    if (!split)
+    {
+        factorSolve(whole, A, current, wholeX);
+        voltage = wholeX;
+        return;
+    }
+
+    voltage.resize(A.rows());
+    for (std::vector<Block *> &level : levels)
+    {
+        std::vector<Block *> large;
+        for (Block *b : level)
+        {
+            if ((int)b->index.size() >= PARALLEL_MIN_SIZE && threads > 1)
+            {
+                large.push_back(b);
+            }
+            else
+            {
+                solveBlock(*b, A, current, voltage);
+            }
+        }
+        if (large.size() < 2)
+        {
+            for (Block *b : large)
+            {
+                solveBlock(*b, A, current, voltage);
+            }
+            continue;
+        }
+
+        // blocks write disjoint entries of voltage and only read those of
+        // earlier levels. A failed block stops the level and its error is
+        // thrown once every thread is done.
+        std::atomic<size_t> next(0);
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        std::function<void()> worker = [&]() {
+            for (size_t k = next++; k < large.size(); k = next++)
+            {
+                try
+                {
+                    solveBlock(*large[k], A, current, voltage);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    error = std::current_exception();
+                    next = large.size();
+                }
+            }
+        };
+        pool.run(std::min<size_t>(threads, large.size()), worker);
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+void Circuit::BlockSolver::solve(const Eigen::SparseMatrix<double> &A, const Eigen::MatrixXd &current, Eigen::MatrixXd &voltage)
+{
+    if (!samePattern(A))
+    {
+        analyze(A);
+    }
+    if (!split && !whole.iterative && !whole.parallel && !mixedPrecision)
+    {
+        factorSolve(whole, A, current, voltage);
+        return;
+    }
+
+    // the other backends take one column at a time, still from one
+    // factorisation since the values stay the same
+    voltage.resize(A.rows(), current.cols());
+    for (int k = 0; k < current.cols(); k++)
+    {
+        column = current.col(k);
+        solve(A, column, columnX);
+        voltage.col(k) = columnX;
+    }
+}
+
+#endif
@@ -17,6 +17,15 @@ private:
 	const double GMIN = 1e-5;
 	const double V_T = 25e-3;
 
+	// bypass caches: the junction is only re-evaluated when its voltage moved
+	// by more than bypassTol since the last evaluation
+	static double bypassTol;
+	static thread_local bool exact;
+	double lastVGuess = NAN;
+	mutable double lastCapVoltage = NAN;
+	mutable double lastCapTimestep = NAN;
+	mutable double capConductance = 0;
+
 public:
 	class ParasiticCapacitance : public Circuit::Capacitor
 	{
@@ -38,6 +47,10 @@ public:
 			}
 
 		}
+		void setCapacitance(double value)
+		{
+			this->value = value;
+		}
 		void setNodes(Node *pos, Node *neg)
 		{
 			this->nodes.push_back(pos);
@@ -50,6 +63,45 @@ public:
 	ParasiticCapacitance *para_cap;
 	Diode() = default;
 
+	// evaluation counters over the diodes of this thread, for tuning bypassTol
+	static thread_local unsigned long evaluations;
+	static thread_local unsigned long bypassed;
+
+	// a negative tolerance turns bypass off
+	static void setBypass(double tol)
+	{
+		bypassTol = tol;
+	}
+	static bool bypassing()
+	{
+		return bypassTol >= 0;
+	}
+	// starts the counters of this thread over, for the report of one run
+	static void resetCounters()
+	{
+		evaluations = 0;
+		bypassed = 0;
+	}
+
+	// Evaluates every diode of this thread exactly while it lives. The steps
+	// of a finite difference Jacobian (~1e-8 V) are below bypassTol, a
+	// bypassed evaluation would leave its column zero.
+	class ExactEvaluation
+	{
+	private:
+		bool saved;
+
+	public:
+		ExactEvaluation() : saved(exact)
+		{
+			exact = true;
+		}
+		~ExactEvaluation()
+		{
+			exact = saved;
+		}
+	};
+
 	Diode(std::string name, std::string nodeA, std::string nodeB, std::string model, Schematic *schem) : Circuit::Component(name, 0.0, schem)
 	{
 		para_cap = new ParasiticCapacitance(schem);
@@ -84,7 +136,20 @@ public:
 
 	double getCurrent(ParamTable *param, double time, double timestep, bool useNeg = false) const override
 	{
-		return getVoltage() * parallelAdd(1.0 / 100.0, (GMIN + inst_conductance))+ para_cap->getCurrent(param, time, timestep, useNeg);
+		double junctionCurrent = getVoltage() * parallelAdd(1.0 / 100.0, (GMIN + inst_conductance));
+		if (timestep < 0)
+		{
+			return junctionCurrent; // capacitance is open at DC
+		}
+		return junctionCurrent + para_cap->getCurrent(param, time, timestep, useNeg);
+	}
+	// starts the junction capacitance at rest at the present bias, as after
+	// the DC operating point
+	void seedCapacitance(ParamTable *param, double timestep)
+	{
+		para_cap->setCap(getVoltage(), this->CJ0, this->VJ);
+		para_cap->setCurrent(param, timestep, 0);
+		lastCapVoltage = NAN;
 	}
 	std::string getModelName()
 	{
@@ -113,13 +178,91 @@ public:
 	}
 	double getConductance(ParamTable *param, double timestep) const override
 	{
+		if (timestep < 0)
+		{
+			return parallelAdd(1.0 / 100.0, (GMIN + inst_conductance));
+		}
 		double vPrev = getVoltage();
-		para_cap->setCap(vPrev, this->CJ0, this->VJ);
-		double capConductance = para_cap->getConductance(param, timestep);
+		evaluations++;
+		if (!exact && timestep == lastCapTimestep && std::abs(vPrev - lastCapVoltage) <= bypassTol)
+		{
+			bypassed++;
+		}
+		else
+		{
+			para_cap->setCap(vPrev, this->CJ0, this->VJ);
+			capConductance = para_cap->getConductance(param, timestep);
+			lastCapVoltage = vPrev;
+			lastCapTimestep = timestep;
+		}
 		return parallelAdd(1.0 / 100.0, (GMIN + inst_conductance)) + capConductance;
 	}
+	double getSaturationCurrent() const
+	{
+		return IS;
+	}
+	double getSeriesResistance() const
+	{
+		return RS;
+	}
+	double getZeroBiasCapacitance() const
+	{
+		return CJ0;
+	}
+	double getJunctionPotential() const
+	{
+		return VJ;
+	}
+	double getThermalVoltage() const
+	{
+		return V_T;
+	}
+	// takes a linearisation computed elsewhere, see DiodeBank
+	void setLinearisation(double vGuess, double current, double conductance)
+	{
+		lastVGuess = vGuess;
+		i_prev = current;
+		inst_conductance = conductance;
+	}
+	// takes the junction capacitance at the previous step's voltage computed
+	// elsewhere, so getConductance does not evaluate it again
+	void setJunctionCapacitance(ParamTable *param, double timestep, double vPrev, double value)
+	{
+		para_cap->setCapacitance(value);
+		capConductance = para_cap->getConductance(param, timestep);
+		lastCapVoltage = vPrev;
+		lastCapTimestep = timestep;
+	}
+	double getJunctionCurrent(double v) const
+	{
+		return IS * (exp(v / V_T) - 1);
+	}
+	// SPICE pnjlim: limits the change of the junction voltage between Newton
+	// iterations above the critical voltage, where the exponential would
+	// otherwise overshoot or overflow
+	double limitVoltage(double vNew, double vOld) const
+	{
+		const double vCrit = V_T * log(V_T / (sqrt(2.0) * IS));
+		if (vNew > vCrit && std::abs(vNew - vOld) > 2 * V_T)
+		{
+			if (vOld > 0)
+			{
+				double arg = 1 + (vNew - vOld) / V_T;
+				return arg > 0 ? vOld + V_T * log(arg) : vCrit;
+			}
+			return V_T * log(vNew / V_T);
+		}
+		return vNew;
+	}
 	void setConductance(ParamTable *param, double timestep, double vGuess)
 	{
+		evaluations++;
+		if (!exact && std::abs(vGuess - lastVGuess) <= bypassTol)
+		{
+			bypassed++;
+			return;
+		}
+		lastVGuess = vGuess;
 		double shockley;
 		shockley = IS * (exp(vGuess / (V_T)) - 1);
 		if (vGuess != 0 && !std::isnan(shockley))
@@ -134,4 +277,9 @@ public:
 		}
 	}
 };
+
+double Circuit::Diode::bypassTol = 1e-6;
+thread_local bool Circuit::Diode::exact = false;
+thread_local unsigned long Circuit::Diode::evaluations = 0;
+thread_local unsigned long Circuit::Diode::bypassed = 0;
 #endif
@@ -0,0 +1,97 @@
+#ifndef GUARD_CIRCUIT_DIODE_BANK_HPP
+#define GUARD_CIRCUIT_DIODE_BANK_HPP
+
+// Structure-of-arrays copy of the diode models of a schematic, evaluated for
+// all junctions at once. The kernel is written as Eigen array expressions, so
+// exp, sqrt and the divisions run on packets (AVX with the -march=native
+// build) instead of one call and one scalar exp/pow per diode. It is the same
+// model as Diode::setConductance and ParasiticCapacitance::setCap, up to the
+// rounding of Eigen's vectorised exp.
+class Circuit::DiodeBank
+{
+private:
+    std::vector<Diode *> diodes;
+    Eigen::ArrayXd IS;
+    Eigen::ArrayXd RS;
+    Eigen::ArrayXd CJ0;
+    Eigen::ArrayXd VJ;
+    Eigen::ArrayXd invVT;
+    Eigen::ArrayXd v;
+
+public:
+    // results of the last evaluate
+    Eigen::ArrayXd current;
+    Eigen::ArrayXd conductance;
+    Eigen::ArrayXd capacitance;
+
+    DiodeBank(const std::vector<Diode *> &diodes) : diodes(diodes)
+    {
+        const int n = diodes.size();
+        IS.resize(n);
+        RS.resize(n);
+        CJ0.resize(n);
+        VJ.resize(n);
+        invVT.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            IS[i] = diodes[i]->getSaturationCurrent();
+            RS[i] = diodes[i]->getSeriesResistance();
+            CJ0[i] = diodes[i]->getZeroBiasCapacitance();
+            VJ[i] = diodes[i]->getJunctionPotential();
+            invVT[i] = 1.0 / diodes[i]->getThermalVoltage();
+        }
+        v.resize(n);
+        current.resize(n);
+        conductance.resize(n);
+        capacitance.resize(n);
+    }
+
+    int size() const
+    {
+        return diodes.size();
+    }
+
+    // Shockley current, secant conductance and depletion capacitance of every
+    // junction at the voltages vDiode, in one call.
+    void evaluate(const Eigen::VectorXd &vDiode)
+    {
+        v = vDiode.array();
+        current = IS * ((v * invVT).exp() - 1);
+        conductance = current / v;
+        capacitance = CJ0 / (1.0 - v / VJ).sqrt();
+        // the branches of the scalar model, kept out of the packet loops
+        for (int i = 0; i < v.size(); i++)
+        {
+            if (v[i] == 0 || std::isnan(current[i]))
+            {
+                current[i] = 0;
+                conductance[i] = 0;
+            }
+            if (v[i] > 1.0)
+            {
+                capacitance[i] = 0;
+            }
+        }
+    }
+
+    // hands the current and conductance of the last evaluate to the diodes
+    void applyLinearisation() const
+    {
+        for (size_t i = 0; i < diodes.size(); i++)
+        {
+            diodes[i]->setLinearisation(v[i], current[i], conductance[i]);
+        }
+    }
+
+    // hands the capacitance of the last evaluate, done at the previous step's
+    // voltages, to the diodes for a step of the given size
+    void applyCapacitance(ParamTable *param, double timestep) const
+    {
+        for (size_t i = 0; i < diodes.size(); i++)
+        {
+            diodes[i]->setJunctionCapacitance(param, timestep, v[i], capacitance[i]);
+        }
+    }
+};
+
+#endif
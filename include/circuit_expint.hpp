@@ -0,0 +1,290 @@
+#ifndef GUARD_CIRCUIT_EXPINT_HPP
+#define GUARD_CIRCUIT_EXPINT_HPP
+
+#include <map>
+#include <vector>
+#include <unsupported/Eigen/MatrixFunctions>
+
+// Exact transient stepping for linear R/L/C circuits.
+//
+// The capacitor voltages and inductor currents are the states s of
+// s' = A s + B u. A and B are found by replacing every capacitor with a
+// voltage source and every inductor with a current source and solving the
+// resulting resistive network once per unit state/input. Source waveforms
+// (DC + sine) are generated by extra exogenous states w with w' = W w, so the
+// whole system z = [s; w] obeys z' = M z and one step is z(t+h) = exp(M h) z(t)
+// with no integration error for any h.
+class Circuit::ExpIntegrator
+{
+private:
+    Schematic *schem;
+    std::vector<Capacitor *> caps;
+    std::vector<Inductor *> inds;
+    std::vector<Voltage *> vSources;
+    std::vector<Current *> iSources;
+    int NUM_NODES = 0;
+    int NUM_STATES = 0;
+
+    Eigen::MatrixXd M;           // augmented generator [[A, B E], [0, W]]
+    Eigen::MatrixXd nodeOut;     // node voltages = nodeOut * z
+    Eigen::MatrixXd capOut;      // capacitor currents = capOut * z
+    Eigen::VectorXd z;
+    Eigen::VectorXd zNext;
+    std::map<double, Eigen::MatrixXd> transitions;
+
+    static void stampConductance(Eigen::SparseMatrix<double> &K, int i, int j, double g)
+    {
+        if (i != -1)
+            K.coeffRef(i, i) += g;
+        if (j != -1)
+            K.coeffRef(j, j) += g;
+        if (i != -1 && j != -1)
+        {
+            K.coeffRef(i, j) -= g;
+            K.coeffRef(j, i) -= g;
+        }
+    }
+
+    static void stampBranch(Eigen::SparseMatrix<double> &K, int i, int j, int row)
+    {
+        if (i != -1)
+        {
+            K.coeffRef(i, row) += 1.0;
+            K.coeffRef(row, i) += 1.0;
+        }
+        if (j != -1)
+        {
+            K.coeffRef(j, row) -= 1.0;
+            K.coeffRef(row, j) -= 1.0;
+        }
+    }
+
+    static void injectCurrent(Eigen::MatrixXd &rhs, int col, int posId, int negId, double val)
+    {
+        if (posId != -1)
+            rhs(posId, col) += val;
+        if (negId != -1)
+            rhs(negId, col) -= val;
+    }
+
+public:
+    ExpIntegrator(Schematic *schem) : schem(schem) {}
+
+    // Extracts the state-space form for the given parameter set. Returns false
+    // if the circuit is not LTI or the capacitor/inductor topology has no
+    // state-space form (capacitor-voltage source loops, inductor cutsets).
+    bool build(ParamTable *param);
+
+    // Resets the states to the zero initial condition used by the companion
+    // model integrator.
+    void reset()
+    {
+        z.setZero();
+        z[NUM_STATES] = 1.0; // constant input generator
+        for (int k = NUM_STATES + 1; k < z.size(); k += 2)
+        {
+            z[k + 1] = 1.0; // cos(0)
+        }
+    }
+
+    // Takes the states from the capacitor voltages and inductor currents
+    // already in the schematic, e.g. after the operating point was applied.
+    void seed(ParamTable *param, double timestep)
+    {
+        reset();
+        for (size_t k = 0; k < caps.size(); k++)
+        {
+            z[k] = caps[k]->getVoltage();
+        }
+        for (size_t k = 0; k < inds.size(); k++)
+        {
+            z[caps.size() + k] = inds[k]->getCurrent(param, 0, timestep);
+        }
+    }
+
+    void advance(double h)
+    {
+        std::map<double, Eigen::MatrixXd>::iterator it = transitions.find(h);
+        if (it == transitions.end())
+        {
+            Eigen::MatrixXd Mh = M * h;
+            it = transitions.insert(std::make_pair(h, Eigen::MatrixXd(Mh.exp()))).first;
+        }
+        zNext.noalias() = it->second * z;
+        z.swap(zNext);
+    }
+
+    // Writes the node voltages and capacitor/inductor currents at the current
+    // state back into the schematic so the usual output routines can be used.
+    void apply(ParamTable *param, double timestep);
+};
+
+bool Circuit::ExpIntegrator::build(ParamTable *param)
+{
+    caps.clear();
+    inds.clear();
+    vSources.clear();
+    iSources.clear();
+    transitions.clear();
+    NUM_NODES = schem->nodes.size() - 1;
+    if (!schem->macromodels.empty())
+    {
+        return false;
+    }
+
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        if (Capacitor *c = dynamic_cast<Capacitor *>(comp.second))
+            caps.push_back(c);
+        else if (Inductor *l = dynamic_cast<Inductor *>(comp.second))
+            inds.push_back(l);
+        else if (Voltage *v = dynamic_cast<Voltage *>(comp.second))
+            vSources.push_back(v);
+        else if (Current *i = dynamic_cast<Current *>(comp.second))
+            iSources.push_back(i);
+        else if (!dynamic_cast<Resistor *>(comp.second))
+            return false;
+    }
+
+    const int nC = caps.size();
+    const int nL = inds.size();
+    const int nV = vSources.size();
+    const int nI = iSources.size();
+    const int nU = nV + nI;
+    const int SIZE = NUM_NODES + nV + nC;
+    NUM_STATES = nC + nL;
+
+    // resistive network: node KCL rows followed by one branch row per
+    // voltage source and per capacitor
+    Eigen::SparseMatrix<double> K(SIZE, SIZE);
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        if (Resistor *r = dynamic_cast<Resistor *>(comp.second))
+        {
+            stampConductance(K, r->getPosNode()->getId(), r->getNegNode()->getId(), r->getConductance(param));
+        }
+    }
+    for (Node *node : schem->shunts)
+    {
+        stampConductance(K, node->getId(), -1, schem->getOption("gshunt", 1e-12));
+    }
+    for (int k = 0; k < nV; k++)
+    {
+        stampBranch(K, vSources[k]->getPosNode()->getId(), vSources[k]->getNegNode()->getId(), NUM_NODES + k);
+    }
+    for (int k = 0; k < nC; k++)
+    {
+        stampBranch(K, caps[k]->getPosNode()->getId(), caps[k]->getNegNode()->getId(), NUM_NODES + nV + k);
+    }
+    K.makeCompressed();
+
+    Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::COLAMDOrdering<int>> lu;
+    lu.compute(K);
+    if (lu.info() != Eigen::Success)
+    {
+        return false;
+    }
+
+    // one right hand side per state followed by one per source input
+    Eigen::MatrixXd rhs = Eigen::MatrixXd::Zero(SIZE, NUM_STATES + nU);
+    for (int k = 0; k < nC; k++)
+    {
+        rhs(NUM_NODES + nV + k, k) = 1.0;
+    }
+    for (int k = 0; k < nL; k++)
+    {
+        injectCurrent(rhs, nC + k, inds[k]->getNegNode()->getId(), inds[k]->getPosNode()->getId(), 1.0);
+    }
+    for (int k = 0; k < nV; k++)
+    {
+        rhs(NUM_NODES + k, NUM_STATES + k) = 1.0;
+    }
+    for (int k = 0; k < nI; k++)
+    {
+        injectCurrent(rhs, NUM_STATES + nV + k, iSources[k]->getPosNode()->getId(), iSources[k]->getNegNode()->getId(), 1.0);
+    }
+    Eigen::MatrixXd X = lu.solve(rhs);
+    if (!X.allFinite())
+    {
+        return false;
+    }
+
+    // exogenous input generator: a constant plus a sin/cos pair per frequency
+    std::vector<double> freqs;
+    std::vector<Source *> sources(vSources.begin(), vSources.end());
+    sources.insert(sources.end(), iSources.begin(), iSources.end());
+    for (Source *src : sources)
+    {
+        if (src->getSineAmplitude() != 0 && src->getSineFrequency() != 0 &&
+            std::find(freqs.begin(), freqs.end(), src->getSineFrequency()) == freqs.end())
+        {
+            freqs.push_back(src->getSineFrequency());
+        }
+    }
+    const int nW = 1 + 2 * freqs.size();
+    Eigen::MatrixXd E = Eigen::MatrixXd::Zero(nU, nW);
+    for (int k = 0; k < nU; k++)
+    {
+        E(k, 0) = sources[k]->getSourceOutput(param, 0);
+        if (sources[k]->getSineAmplitude() != 0 && sources[k]->getSineFrequency() != 0)
+        {
+            int f = std::find(freqs.begin(), freqs.end(), sources[k]->getSineFrequency()) - freqs.begin();
+            E(k, 1 + 2 * f) = sources[k]->getSineAmplitude();
+        }
+    }
+
+    // node voltage and branch current responses: x = Xs * s + Xu * E * w
+    Eigen::MatrixXd Xz(SIZE, NUM_STATES + nW);
+    Xz << X.leftCols(NUM_STATES), X.rightCols(nU) * E;
+
+    M = Eigen::MatrixXd::Zero(NUM_STATES + nW, NUM_STATES + nW);
+    for (int k = 0; k < nC; k++)
+    {
+        M.row(k) = Xz.row(NUM_NODES + nV + k) / caps[k]->getValue(param);
+    }
+    for (int k = 0; k < nL; k++)
+    {
+        Eigen::RowVectorXd vL = Eigen::RowVectorXd::Zero(NUM_STATES + nW);
+        int posId = inds[k]->getPosNode()->getId();
+        int negId = inds[k]->getNegNode()->getId();
+        if (posId != -1)
+            vL += Xz.row(posId);
+        if (negId != -1)
+            vL -= Xz.row(negId);
+        M.row(nC + k) = vL / inds[k]->getValue(param);
+    }
+    for (size_t f = 0; f < freqs.size(); f++)
+    {
+        double omega = 2.0 * M_PI * freqs[f];
+        M(NUM_STATES + 1 + 2 * f, NUM_STATES + 2 + 2 * f) = omega;
+        M(NUM_STATES + 2 + 2 * f, NUM_STATES + 1 + 2 * f) = -omega;
+    }
+
+    nodeOut = Xz.topRows(NUM_NODES);
+    capOut = Xz.bottomRows(nC);
+    z.resize(NUM_STATES + nW);
+    zNext.resize(NUM_STATES + nW);
+    reset();
+    return true;
+}
+
+void Circuit::ExpIntegrator::apply(ParamTable *param, double timestep)
+{
+    for (std::pair<std::string, Node *> node : schem->nodes)
+    {
+        if (node.second->getId() != -1)
+        {
+            node.second->voltage = nodeOut.row(node.second->getId()).dot(z);
+        }
+    }
+    for (size_t k = 0; k < caps.size(); k++)
+    {
+        caps[k]->setCurrent(param, timestep, capOut.row(k).dot(z));
+    }
+    for (size_t k = 0; k < inds.size(); k++)
+    {
+        inds[k]->setCurrent(param, timestep, z[caps.size() + k]);
+    }
+}
+
+#endif
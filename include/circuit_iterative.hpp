@@ -0,0 +1,84 @@
+#ifndef GUARD_CIRCUIT_ITERATIVE_HPP
+#define GUARD_CIRCUIT_ITERATIVE_HPP
+
+// Preconditioned Krylov solver for blocks too large to factorise directly.
+// Symmetric positive definite blocks, e.g. resistive grids whose sources have
+// been split off by the block decomposition, use conjugate gradients with an
+// incomplete Cholesky preconditioner, everything else uses BiCGSTAB with an
+// ILUT preconditioner. Memory stays proportional to the nonzeros of the block
+// plus the bounded fill of the preconditioner.
+class Circuit::IterativeSolver
+{
+private:
+    typedef Eigen::SparseMatrix<double> Matrix;
+
+    Eigen::ConjugateGradient<Matrix, Eigen::Lower | Eigen::Upper, Eigen::IncompleteCholesky<double>> cg;
+    Eigen::BiCGSTAB<Matrix, Eigen::IncompleteLUT<double>> bicgstab;
+    Matrix A; // the solvers keep a reference to the matrix they were computed on
+    bool spd = false;
+    bool ready = false;
+
+    static bool isSPD(const Matrix &A)
+    {
+        Matrix At = A.transpose();
+        if ((A - At).norm() > 1e-12 * A.norm())
+        {
+            return false;
+        }
+        for (int i = 0; i < A.rows(); i++)
+        {
+            if (A.coeff(i, i) <= 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    double tolerance = 1e-10;
+    int maxIterations = 1000;
+
+    // Builds the preconditioner, skipped when the values have not changed
+    // since the last call, as in a fixed step linear transient.
+    bool compute(const Matrix &matrix)
+    {
+        if (A.nonZeros() == matrix.nonZeros() && std::equal(A.valuePtr(), A.valuePtr() + A.nonZeros(), matrix.valuePtr()))
+        {
+            return ready;
+        }
+        A = matrix;
+        spd = isSPD(A);
+        if (spd)
+        {
+            cg.setTolerance(tolerance);
+            cg.setMaxIterations(maxIterations);
+            cg.compute(A);
+            ready = cg.info() == Eigen::Success;
+            return ready;
+        }
+        bicgstab.setTolerance(tolerance);
+        bicgstab.setMaxIterations(maxIterations);
+        bicgstab.compute(A);
+        ready = bicgstab.info() == Eigen::Success;
+        return ready;
+    }
+
+    // x holds the starting guess, normally the previous solution
+    bool solve(const Eigen::VectorXd &rhs, Eigen::VectorXd &x)
+    {
+        if (x.size() != rhs.size())
+        {
+            x = Eigen::VectorXd::Zero(rhs.size());
+        }
+        if (spd)
+        {
+            x = cg.solveWithGuess(rhs, x);
+            return cg.info() == Eigen::Success;
+        }
+        x = bicgstab.solveWithGuess(rhs, x);
+        return bicgstab.info() == Eigen::Success;
+    }
+};
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef GUARD_CIRCUIT_LANE_LU_HPP
+#define GUARD_CIRCUIT_LANE_LU_HPP
+
+#include <Eigen/OrderingMethods>
+
+// Sparse LU of WIDTH matrices with the same sparsity pattern at once, one per
+// SIMD lane. Every stored value is a Lane of WIDTH doubles, so the
+// factorisation and the triangular solves run the scalar algorithm once with
+// vector arithmetic across the lanes.
+//
+// The symbolic analysis is shared by the lanes, which rules out pivoting by
+// value: the matrix is ordered by AMD on the pattern of A + A^T and factorised
+// in that order, with the fill of L + U taken from the symbolic Cholesky
+// factor of the same pattern. The right-looking updates of the numeric
+// factorisation are precomputed as a flat list of destinations, so
+// factorising is one pass over that list. A lane whose pivot collapses below
+// PIVOT_TOL of its column is reported as failed and has to be solved some
+// other way; MNA matrices, whose diagonal is kept nonzero by the voltage
+// source rows, rarely need that.
+class Circuit::LaneLU
+{
+public:
+    static constexpr int WIDTH = Eigen::internal::packet_traits<double>::size;
+    typedef Eigen::Array<double, WIDTH, 1> Lane;
+
+private:
+    static constexpr double PIVOT_TOL = 1e-10;
+
+    int n = 0;
+    std::vector<int> order;      // new index of each row/column
+    std::vector<int> colStart;   // struct(k) = rows[colStart[k]..colStart[k + 1])
+    std::vector<int> rows;       // rows below the diagonal of L(:, k), ascending
+    std::vector<int> updates;    // destination of each right-looking update
+    Eigen::SparseMatrix<double> pattern;
+
+    // diagonal, then the strict lower part of L by column, then the strict
+    // upper part of U by row over the same index sets
+    std::vector<Lane, Eigen::aligned_allocator<Lane>> values;
+    std::vector<Lane, Eigen::aligned_allocator<Lane>> columnMax;
+    std::vector<Lane, Eigen::aligned_allocator<Lane>> work;
+    std::vector<bool> failed;
+
+    int lower(int p) const
+    {
+        return n + p;
+    }
+    int upper(int p) const
+    {
+        return n + rows.size() + p;
+    }
+
+    // slot of entry (i, j) of the reordered matrix, which has to be in the
+    // filled pattern
+    int slot(int i, int j) const
+    {
+        if (i == j)
+        {
+            return i;
+        }
+        const int k = std::min(i, j);
+        const int other = std::max(i, j);
+        const int p = std::lower_bound(rows.begin() + colStart[k], rows.begin() + colStart[k + 1], other) - rows.begin();
+        return i > j ? lower(p) : upper(p);
+    }
+
+public:
+    // Symbolic analysis of the pattern of A, which is kept. Returns false if
+    // the precomputed factorisation would hold more than maxUpdates updates.
+    bool analyze(const Eigen::SparseMatrix<double> &A, size_t maxUpdates);
+
+    // copies the values of A, which must have the analysed pattern, into lane
+    // lane. Returns false if A has an entry outside the pattern.
+    bool setLane(int lane, const Eigen::SparseMatrix<double> &A);
+
+    // copies the values of lane from into lane to, for lanes without a matrix
+    // of their own
+    void copyLane(int from, int to);
+
+    // factorises every lane, see failedLane
+    void factorize();
+
+    // true if the pivots of lane collapsed, its solutions are meaningless
+    bool failedLane(int lane) const
+    {
+        return failed[lane];
+    }
+
+    // solves every lane in place, x holds one Lane per row
+    void solve(std::vector<Lane, Eigen::aligned_allocator<Lane>> &x);
+
+    int size() const
+    {
+        return n;
+    }
+};
+
+bool Circuit::LaneLU::analyze(const Eigen::SparseMatrix<double> &A, size_t maxUpdates)
+{
+    n = A.rows();
+    pattern = A;
+    pattern.makeCompressed();
+
+    // AMD on the symmetric pattern with the diagonal
+    Eigen::SparseMatrix<double> S = A.cwiseAbs();
+    Eigen::SparseMatrix<double> At = S.transpose();
+    S += At;
+    for (int i = 0; i < n; i++)
+    {
+        S.coeffRef(i, i) += 1;
+    }
+    S.makeCompressed();
+    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> inverse;
+    Eigen::AMDOrdering<int> amd;
+    amd(S, inverse);
+    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> permutation = inverse.inverse();
+    order.assign(permutation.indices().data(), permutation.indices().data() + n);
+
+    // symmetric pattern in the new order, by row, below the diagonal
+    std::vector<std::vector<int>> below(n);
+    for (int j = 0; j < n; j++)
+    {
+        for (Eigen::SparseMatrix<double>::InnerIterator it(S, j); it; ++it)
+        {
+            const int i = order[it.row()];
+            const int jj = order[j];
+            if (i > jj)
+            {
+                below[i].push_back(jj);
+            }
+        }
+    }
+
+    // elimination tree, then the pattern of every row of the Cholesky factor
+    // as the tree paths from its entries up to the diagonal
+    std::vector<int> parent(n, -1), ancestor(n, -1), mark(n, -1);
+    for (int i = 0; i < n; i++)
+    {
+        for (int j : below[i])
+        {
+            while (j != -1 && j < i)
+            {
+                const int next = ancestor[j];
+                ancestor[j] = i;
+                if (next == -1)
+                {
+                    parent[j] = i;
+                }
+                j = next;
+            }
+        }
+    }
+    std::vector<std::vector<int>> structure(n);
+    for (int i = 0; i < n; i++)
+    {
+        mark[i] = i;
+        for (int j : below[i])
+        {
+            for (; mark[j] != i; j = parent[j])
+            {
+                mark[j] = i;
+                structure[j].push_back(i);
+            }
+        }
+    }
+    colStart.assign(n + 1, 0);
+    rows.clear();
+    size_t count = 0;
+    for (int k = 0; k < n; k++)
+    {
+        colStart[k] = rows.size();
+        rows.insert(rows.end(), structure[k].begin(), structure[k].end());
+        count += structure[k].size() * structure[k].size();
+    }
+    colStart[n] = rows.size();
+    if (count > maxUpdates)
+    {
+        return false;
+    }
+
+    // A(i, j) -= L(i, k) U(k, j) for every i, j in struct(k)
+    updates.clear();
+    updates.reserve(count);
+    for (int k = 0; k < n; k++)
+    {
+        for (int a = colStart[k]; a < colStart[k + 1]; a++)
+        {
+            for (int b = colStart[k]; b < colStart[k + 1]; b++)
+            {
+                updates.push_back(slot(rows[a], rows[b]));
+            }
+        }
+    }
+
+    values.assign(n + 2 * rows.size(), Lane::Zero());
+    columnMax.assign(n, Lane::Zero());
+    work.resize(n);
+    failed.assign(WIDTH, false);
+    return true;
+}
+
+bool Circuit::LaneLU::setLane(int lane, const Eigen::SparseMatrix<double> &A)
+{
+    for (int j = 0; j < n; j++)
+    {
+        const int *begin = pattern.innerIndexPtr() + pattern.outerIndexPtr()[j];
+        const int *end = pattern.innerIndexPtr() + pattern.outerIndexPtr()[j + 1];
+        for (Eigen::SparseMatrix<double>::InnerIterator it(A, j); it; ++it)
+        {
+            if (it.value() != 0 && !std::binary_search(begin, end, (int)it.row()))
+            {
+                return false;
+            }
+        }
+    }
+    for (Lane &v : values)
+    {
+        v[lane] = 0;
+    }
+    for (Lane &m : columnMax)
+    {
+        m[lane] = 0;
+    }
+    for (int j = 0; j < n; j++)
+    {
+        for (Eigen::SparseMatrix<double>::InnerIterator it(A, j); it; ++it)
+        {
+            values[slot(order[it.row()], order[j])][lane] = it.value();
+            double &m = columnMax[order[j]][lane];
+            m = std::max(m, std::abs(it.value()));
+        }
+    }
+    return true;
+}
+
+void Circuit::LaneLU::copyLane(int from, int to)
+{
+    for (Lane &v : values)
+    {
+        v[to] = v[from];
+    }
+    for (Lane &m : columnMax)
+    {
+        m[to] = m[from];
+    }
+}
+
+void Circuit::LaneLU::factorize()
+{
+    std::fill(failed.begin(), failed.end(), false);
+    const int *update = updates.data();
+    for (int k = 0; k < n; k++)
+    {
+        Lane &pivot = values[k];
+        for (int lane = 0; lane < WIDTH; lane++)
+        {
+            if (!(std::abs(pivot[lane]) > PIVOT_TOL * columnMax[k][lane]))
+            {
+                // carry on with a harmless pivot, the lane is discarded
+                failed[lane] = true;
+                pivot[lane] = 1;
+            }
+        }
+        const Lane inverse = pivot.inverse();
+        for (int p = colStart[k]; p < colStart[k + 1]; p++)
+        {
+            values[lower(p)] *= inverse;
+        }
+        for (int a = colStart[k]; a < colStart[k + 1]; a++)
+        {
+            const Lane l = values[lower(a)];
+            for (int b = colStart[k]; b < colStart[k + 1]; b++)
+            {
+                values[*update++] -= l * values[upper(b)];
+            }
+        }
+    }
+}
+
+void Circuit::LaneLU::solve(std::vector<Lane, Eigen::aligned_allocator<Lane>> &x)
+{
+    for (int i = 0; i < n; i++)
+    {
+        work[order[i]] = x[i];
+    }
+    for (int k = 0; k < n; k++)
+    {
+        const Lane xk = work[k];
+        for (int p = colStart[k]; p < colStart[k + 1]; p++)
+        {
+            work[rows[p]] -= values[lower(p)] * xk;
+        }
+    }
+    for (int k = n - 1; k >= 0; k--)
+    {
+        Lane sum = work[k];
+        for (int p = colStart[k]; p < colStart[k + 1]; p++)
+        {
+            sum -= values[upper(p)] * work[rows[p]];
+        }
+        work[k] = sum / values[k];
+    }
+    for (int i = 0; i < n; i++)
+    {
+        x[i] = work[order[i]];
+    }
+}
+
+#endif
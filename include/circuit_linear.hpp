@@ -17,6 +17,21 @@ public:
     {
         return (getVoltage()) * getConductance(param, timestep) - i_prev;
     }
+    // sets the history term so getCurrent reports the given current
+    void setCurrent(ParamTable *param, double timestep, double current)
+    {
+        i_prev = getVoltage() * getConductance(param, timestep) - current;
+    }
+    // the companion model's history term, the only state it keeps besides
+    // the node voltages
+    double getHistory() const
+    {
+        return i_prev;
+    }
+    void setHistory(double history)
+    {
+        i_prev = history;
+    }
     virtual ~LC(){};
 };
 
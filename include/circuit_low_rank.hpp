@@ -0,0 +1,177 @@
+#ifndef GUARD_CIRCUIT_LOW_RANK_HPP
+#define GUARD_CIRCUIT_LOW_RANK_HPP
+
+// Transient solver for circuits whose only nonlinear elements are the diodes.
+// Between Newton iterations only the k diode conductances change, and each
+// diode stamp g b b^T is rank one, so the system is
+//   A(g) = A0 + U diag(g - g0) B^T
+// with A0 the matrix at the conductances g0 it was factorised with, B the
+// diode incidence and U = R B its image under the voltage source rows. A0 is
+// factorised once per timestep size; every solve after that is the Woodbury
+// correction
+//   x = y - Z t,  (I + D W) t = D B^T y,  D = diag(g - g0)
+// with y = A0^-1 r, Z = A0^-1 U and W = B^T Z. The right hand side of a step
+// does not depend on the diode voltages, so y is one solve per step and the
+// diode voltages B^T x of a Newton iteration cost a k x k dense solve.
+class Circuit::LowRankSolver
+{
+private:
+    typedef Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::COLAMDOrdering<int>> LU;
+
+    Schematic *schem;
+    ParamTable *param;
+    const int NUM_NODES;
+    const int NUM_DIODES;
+
+    LU lu;
+    Eigen::SparseMatrix<double> sparse;
+    bool factored = false;
+    double factoredStep = NAN;
+
+    Eigen::MatrixXd U;
+    Eigen::MatrixXd Z;
+    Eigen::MatrixXd W;
+    Eigen::VectorXd g0;
+    Eigen::VectorXd y;
+    Eigen::VectorXd By;
+
+    Eigen::VectorXd d;
+    Eigen::VectorXd t;
+    Eigen::MatrixXd M;
+    Eigen::PartialPivLU<Eigen::MatrixXd> small;
+    unsigned long factorisations = 0;
+
+    template <typename Vector>
+    double voltageAcross(const Vector &voltage, int i) const
+    {
+        int posId = schem->nonLinearComps[i]->getPosNode()->getId();
+        int negId = schem->nonLinearComps[i]->getNegNode()->getId();
+        return (posId != -1 ? voltage[posId] : 0) - (negId != -1 ? voltage[negId] : 0);
+    }
+
+    // solves the correction for the present diode conductances into t,
+    // false if the k x k system is singular
+    bool correct()
+    {
+        for (int i = 0; i < NUM_DIODES; i++)
+        {
+            d[i] = schem->nonLinearComps[i]->getConductance(param, factoredStep) - g0[i];
+        }
+        M = d.asDiagonal() * W;
+        M.diagonal().array() += 1.0;
+        small.compute(M);
+        t = small.solve(d.cwiseProduct(By));
+        return t.allFinite();
+    }
+
+public:
+    LowRankSolver(Schematic *schem, ParamTable *param)
+        : schem(schem), param(param), NUM_NODES(schem->nodes.size() - 1), NUM_DIODES(schem->nonLinearComps.size()),
+          U(NUM_NODES, NUM_DIODES), Z(NUM_NODES, NUM_DIODES), W(NUM_DIODES, NUM_DIODES), g0(NUM_DIODES), y(NUM_NODES),
+          By(NUM_DIODES), d(NUM_DIODES), t(NUM_DIODES), M(NUM_DIODES, NUM_DIODES)
+    {
+        Eigen::VectorXd column(NUM_NODES);
+        for (int i = 0; i < NUM_DIODES; i++)
+        {
+            column.setZero();
+            int posId = schem->nonLinearComps[i]->getPosNode()->getId();
+            int negId = schem->nonLinearComps[i]->getNegNode()->getId();
+            if (posId != -1)
+                column[posId] = 1.0;
+            if (negId != -1)
+                column[negId] = -1.0;
+            Math::applyVoltageSourceRows(schem, column);
+            U.col(i) = column;
+        }
+    }
+
+    // Sets up the step at time t. conductance and current are workspaces of
+    // the system size, conductance is left unused when the system is
+    // assembled sparse; the matrix is only assembled and factorised when the
+    // timestep differs from the one A0 was built for. Returns false if A0 is
+    // singular, the caller then has to solve the full system.
+    bool prepare(double time, double timestep, Eigen::MatrixXd &conductance, Eigen::VectorXd &current)
+    {
+        if (!factored || timestep != factoredStep)
+        {
+            factored = false;
+            factoredStep = timestep;
+            if (Math::assemblesSparse(current.size()))
+            {
+                Math::getConductanceTRAN(schem, sparse, param, time, timestep);
+                Math::getCurrentTRAN(schem, current, sparse, param, time, timestep);
+            }
+            else
+            {
+                Math::getConductanceTRAN(schem, conductance, param, time, timestep);
+                Math::getCurrentTRAN(schem, current, conductance, param, time, timestep);
+                sparse = conductance.sparseView();
+                sparse.makeCompressed();
+            }
+            for (int i = 0; i < NUM_DIODES; i++)
+            {
+                g0[i] = schem->nonLinearComps[i]->getConductance(param, timestep);
+            }
+            lu.analyzePattern(sparse);
+            lu.factorize(sparse);
+            factorisations++;
+            if (lu.info() != Eigen::Success)
+            {
+                return false;
+            }
+            Z = lu.solve(U);
+            for (int j = 0; j < NUM_DIODES; j++)
+            {
+                for (int i = 0; i < NUM_DIODES; i++)
+                {
+                    W(i, j) = voltageAcross(Z.col(j), i);
+                }
+            }
+            factored = Z.allFinite();
+        }
+        else
+        {
+            Math::getCurrentTRAN(schem, current, param, time, timestep);
+        }
+        if (!factored)
+        {
+            return false;
+        }
+        y = lu.solve(current);
+        for (int i = 0; i < NUM_DIODES; i++)
+        {
+            By[i] = voltageAcross(y, i);
+        }
+        return y.allFinite();
+    }
+
+    // diode voltages of the system with the diodes as they are linearised now
+    bool diodeVoltages(Eigen::VectorXd &vDiode)
+    {
+        if (!correct())
+        {
+            return false;
+        }
+        vDiode.noalias() = By - W * t;
+        return true;
+    }
+
+    // all node voltages, as diodeVoltages
+    bool voltages(Eigen::VectorXd &voltage)
+    {
+        if (!correct())
+        {
+            return false;
+        }
+        voltage = y;
+        voltage.noalias() -= Z * t;
+        return true;
+    }
+
+    unsigned long getFactorisations() const
+    {
+        return factorisations;
+    }
+};
+
+#endif
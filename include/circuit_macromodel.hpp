@@ -0,0 +1,208 @@
+#ifndef GUARD_CIRCUIT_MACROMODEL_HPP
+#define GUARD_CIRCUIT_MACROMODEL_HPP
+
+#include <map>
+
+// Reduced order model of a linear subnetwork as seen from its ports, with
+// ground as the reference. The internal states q obey
+//     Gr q + Cr q' = Br i,    v = Br^T q
+// where i are the currents flowing from the port nodes into the model. Each
+// timestep is discretised with backward Euler, like the capacitor and inductor
+// companion models, which folds the model into a dense port admittance Y plus a
+// history current Y * vHist.
+class Circuit::Macromodel : public Circuit::Component
+{
+private:
+    struct Companion
+    {
+        Eigen::MatrixXd Y; // port admittance
+        Eigen::MatrixXd P; // q(n+1) = P q(n) + Q i(n+1)
+        Eigen::MatrixXd Q;
+        Eigen::MatrixXd H; // vHist = H q(n)
+    };
+
+    Eigen::MatrixXd Gr;
+    Eigen::MatrixXd Cr;
+    Eigen::MatrixXd Br;
+    Eigen::VectorXd q;
+    Eigen::VectorXd vPort;
+    Eigen::VectorXd vHist;
+    Eigen::VectorXd iPort;
+    std::map<double, Companion> companions;
+    double activeStep = 0;
+    double lastTime = -1;
+    bool pending = false; // a step has been stamped but not yet committed to q
+
+    const Companion &getCompanion(double timestep);
+
+    void readPortVoltages()
+    {
+        for (size_t k = 0; k < nodes.size(); k++)
+        {
+            vPort[k] = nodes[k]->voltage;
+        }
+    }
+
+public:
+    Macromodel(const std::string &name, const std::vector<Node *> &ports, const Eigen::MatrixXd &Gr, const Eigen::MatrixXd &Cr, const Eigen::MatrixXd &Br, Schematic *schem)
+        : Component(name, 0.0, schem), Gr(Gr), Cr(Cr), Br(Br)
+    {
+        for (Node *n : ports)
+        {
+            n->comps.push_back(this);
+            nodes.push_back(n);
+        }
+        q = Eigen::VectorXd::Zero(Gr.rows());
+        vPort = Eigen::VectorXd::Zero(ports.size());
+        vHist = Eigen::VectorXd::Zero(ports.size());
+        iPort = Eigen::VectorXd::Zero(ports.size());
+    }
+
+    int order() const
+    {
+        return Gr.rows();
+    }
+
+    // timestep < 0 gives the DC model (capacitors open, inductors shorted)
+    void stampConductance(Eigen::MatrixXd &conductance, double timestep)
+    {
+        const Eigen::MatrixXd &Y = getCompanion(timestep).Y;
+        for (size_t a = 0; a < nodes.size(); a++)
+        {
+            for (size_t b = 0; b < nodes.size(); b++)
+            {
+                if (nodes[a]->getId() != -1 && nodes[b]->getId() != -1)
+                {
+                    conductance(nodes[a]->getId(), nodes[b]->getId()) += Y(a, b);
+                }
+            }
+        }
+    }
+    // the same stamp as triplets, for systems assembled sparse
+    void stampConductance(std::vector<Eigen::Triplet<double>> &conductance, double timestep)
+    {
+        const Eigen::MatrixXd &Y = getCompanion(timestep).Y;
+        for (size_t a = 0; a < nodes.size(); a++)
+        {
+            for (size_t b = 0; b < nodes.size(); b++)
+            {
+                if (nodes[a]->getId() != -1 && nodes[b]->getId() != -1)
+                {
+                    conductance.emplace_back(nodes[a]->getId(), nodes[b]->getId(), Y(a, b));
+                }
+            }
+        }
+    }
+
+    // Commits the state of the previous timestep (the node voltages still hold
+    // its solution) the first time it is called for a new time, so repeated
+    // calls within one timestep, e.g. from the nonlinear solver, are safe.
+    void stampCurrent(Eigen::VectorXd &current, double t, double timestep)
+    {
+        if (t != lastTime)
+        {
+            if (pending)
+            {
+                const Companion &prev = getCompanion(activeStep);
+                readPortVoltages();
+                iPort.noalias() = prev.Y * (vPort - vHist);
+                q = prev.P * q + prev.Q * iPort;
+            }
+            activeStep = timestep;
+            vHist.noalias() = getCompanion(activeStep).H * q;
+            lastTime = t;
+            pending = true;
+        }
+        iPort.noalias() = getCompanion(activeStep).Y * vHist;
+        for (size_t k = 0; k < nodes.size(); k++)
+        {
+            if (nodes[k]->getId() != -1)
+            {
+                current[nodes[k]->getId()] += iPort[k];
+            }
+        }
+    }
+
+    // Sets the internal states to the DC solution at the present port
+    // voltages, the starting point of a transient after the operating point.
+    void seedDC()
+    {
+        const Companion &dc = getCompanion(-1);
+        readPortVoltages();
+        iPort.noalias() = dc.Y * vPort;
+        q = dc.Q * iPort;
+        if (!q.allFinite())
+        {
+            q.setZero();
+        }
+        // report the DC port currents until the first step is stamped
+        activeStep = -1;
+        vHist.setZero();
+        lastTime = 0;
+        pending = false;
+    }
+
+    void resetState()
+    {
+        q.setZero();
+        vHist.setZero();
+        lastTime = -1;
+        pending = false;
+    }
+
+    // current flowing from n into the model at the present node voltages
+    double getNodeCurrent(const Node *n, ParamTable *param, double t, double timestep) const override
+    {
+        std::vector<Node *>::const_iterator it = std::find(nodes.begin(), nodes.end(), n);
+        if (it == nodes.end())
+        {
+            return 0;
+        }
+        const bool dc = timestep < 0;
+        std::map<double, Companion>::const_iterator c = companions.find(dc ? timestep : activeStep);
+        if (c == companions.end())
+        {
+            return 0;
+        }
+        double i = 0;
+        for (size_t k = 0; k < nodes.size(); k++)
+        {
+            i += c->second.Y(it - nodes.begin(), k) * (nodes[k]->voltage - (dc ? 0 : vHist[k]));
+        }
+        return i;
+    }
+};
+
+const Circuit::Macromodel::Companion &Circuit::Macromodel::getCompanion(double timestep)
+{
+    std::map<double, Companion>::iterator it = companions.find(timestep);
+    if (it != companions.end())
+    {
+        return it->second;
+    }
+    if (companions.size() > 8)
+    {
+        // variable step runs would otherwise grow the cache without bound
+        for (it = companions.begin(); it != companions.end();)
+        {
+            it = it->first == activeStep ? std::next(it) : companions.erase(it);
+        }
+    }
+
+    Companion c;
+    Eigen::MatrixXd Mh = Gr;
+    Eigen::MatrixXd Ch = Eigen::MatrixXd::Zero(Cr.rows(), Cr.cols());
+    if (timestep > 0)
+    {
+        Ch = Cr / timestep;
+        Mh += Ch;
+    }
+    Eigen::FullPivLU<Eigen::MatrixXd> lu(Mh);
+    c.Q = lu.solve(Br);
+    c.P = lu.solve(Ch);
+    c.H = Br.transpose() * c.P;
+    c.Y = (Br.transpose() * c.Q).fullPivLu().inverse();
+    return companions.insert(std::make_pair(timestep, c)).first->second;
+}
+
+#endif
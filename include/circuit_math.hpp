@@ -4,8 +4,64 @@
 class Circuit::Math
 {
 private:
-    static Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::COLAMDOrdering<int>> solver;
-    static Eigen::SparseMatrix<double> sparse;
+    // Every thread solves with a BlockSolver of its own, so that independent
+    // runs can go in parallel. The settings are made on a prototype and
+    // copied into a thread's solver on its first solve after they change.
+    static BlockSolver settings;
+    static int settingsVersion;
+    static thread_local BlockSolver solver;
+    static thread_local int solverVersion;
+    static thread_local unsigned int threadLimit; // 0 for none
+    static thread_local Eigen::SparseMatrix<double> sparse;
+    static thread_local std::vector<Eigen::Triplet<double>> triplets;
+    static int sparseMinSize;
+
+    static BlockSolver &threadSolver()
+    {
+        if (solverVersion != settingsVersion)
+        {
+            solver.setSettings(settings);
+            if (threadLimit > 0)
+            {
+                solver.setThreads(std::min(threadLimit, settings.getThreads()));
+            }
+            solverVersion = settingsVersion;
+        }
+        return solver;
+    }
+
+    // systems up to this size are solved densely on the stack
+    static constexpr int DENSE_MAX_SIZE = 16;
+
+    // PartialPivLU goes on past a zero pivot and returns inf or NaN, so a
+    // singular system throws here, as it does from SparseLU, for the caller
+    // to skip the solve
+    template <class LU>
+    static const LU &checkPivots(const LU &lu)
+    {
+        if ((lu.matrixLU().diagonal().array() == 0.0).any())
+        {
+            throw std::runtime_error("zero pivot in the dense LU");
+        }
+        return lu;
+    }
+
+    // finds the fixed size matching the system at compile time so the LU runs
+    // without heap allocation or sparse bookkeeping
+    template <int N>
+    static void solveFixed(const Eigen::MatrixXd &conductance, Eigen::VectorXd &voltage, const Eigen::VectorXd &current)
+    {
+        if (conductance.rows() == N)
+        {
+            const Eigen::Matrix<double, N, N> A = conductance;
+            const Eigen::Matrix<double, N, 1> b = current;
+            voltage = checkPivots(Eigen::PartialPivLU<Eigen::Matrix<double, N, N>>(A)).solve(b);
+        }
+        else if constexpr (N > 1)
+        {
+            solveFixed<N - 1>(conductance, voltage, current);
+        }
+    }
 
     static void init_matrix(Eigen::MatrixXd &mat, double val = 0.0)
     {
@@ -33,6 +89,13 @@ private:
             conductance(i, j) += val;
         }
     }
+    static void addConductanceToMatrix(std::vector<Eigen::Triplet<double>> &conductance, int i, int j, double val)
+    {
+        if (i != -1 && j != -1)
+        {
+            conductance.emplace_back(i, j, val);
+        }
+    }
 
     static void handleCurrentSource(Eigen::VectorXd &current, int posId, int negId, double val)
     {
@@ -40,54 +103,202 @@ private:
         addCurrentToVector(current, negId, -val);
     }
 
+    // replaces the KCL row of a source terminal in place, so assembling a
+    // matrix allocates nothing
     static void handleVoltageSource(Eigen::MatrixXd &conductance, Eigen::VectorXd &current, int posId, int negId, double val)
     {
-        Eigen::VectorXd new_conductance(current.rows());
-        init_vector(new_conductance);
-
+        handleVoltageSourceRows(conductance, posId, negId);
+        handleVoltageSourceCurrent(current, posId, negId, val);
+    }
+    // the matrix half of handleVoltageSource
+    static void handleVoltageSourceRows(Eigen::MatrixXd &conductance, int posId, int negId)
+    {
         if (posId != -1)
         {
-            new_conductance(posId) = 1.0;
             if (negId == -1)
             {
-                conductance.row(posId) = new_conductance;
-                current[posId] = val;
-                return;
+                conductance.row(posId).setZero();
+                conductance(posId, posId) = 1.0;
             }
             else
             {
-                new_conductance(negId) = -1.0;
                 conductance.row(negId) += conductance.row(posId);
-                conductance.row(posId) = new_conductance;
-
-                current[negId] += current[posId];
-                current[posId] = val;
-                return;
+                conductance.row(posId).setZero();
+                conductance(posId, posId) = 1.0;
+                conductance(posId, negId) = -1.0;
             }
         }
         else
         {
             assert(negId != -1 && "Both terminals cannot be connected to ground");
-            new_conductance(negId) = -1.0;
+            conductance.row(negId).setZero();
+            conductance(negId, negId) = -1.0;
+        }
+    }
+    // A row of a sparse system after the voltage sources: the sum of the KCL
+    // rows listed plus fixed entries. handleVoltageSourceRows works on these
+    // instead of the matrix, so a sparse system is rebuilt once for all the
+    // sources rather than once per source.
+    struct SourceRow
+    {
+        std::vector<int> kcl;
+        std::vector<std::pair<int, double>> fixed;
+    };
+    static SourceRow &sourceRow(std::map<int, SourceRow> &rows, int id)
+    {
+        std::map<int, SourceRow>::iterator it = rows.find(id);
+        if (it == rows.end())
+        {
+            it = rows.emplace(id, SourceRow{{id}, {}}).first;
+        }
+        return it->second;
+    }
+    static void handleVoltageSourceRows(std::map<int, SourceRow> &rows, int posId, int negId)
+    {
+        if (posId != -1)
+        {
+            if (negId == -1)
+            {
+                rows[posId] = SourceRow{{}, {{posId, 1.0}}};
+            }
+            else
+            {
+                SourceRow &pos = sourceRow(rows, posId);
+                SourceRow &neg = sourceRow(rows, negId);
+                neg.kcl.insert(neg.kcl.end(), pos.kcl.begin(), pos.kcl.end());
+                neg.fixed.insert(neg.fixed.end(), pos.fixed.begin(), pos.fixed.end());
+                pos = SourceRow{{}, {{posId, 1.0}, {negId, -1.0}}};
+            }
+        }
+        else
+        {
+            assert(negId != -1 && "Both terminals cannot be connected to ground");
+            rows[negId] = SourceRow{{}, {{negId, -1.0}}};
+        }
+    }
+    static void applySourceRows(const std::map<int, SourceRow> &rows, Eigen::SparseMatrix<double> &conductance);
+    // the right hand side half of handleVoltageSource
+    static void handleVoltageSourceCurrent(Eigen::VectorXd &current, int posId, int negId, double val)
+    {
+        if (posId != -1)
+        {
+            if (negId != -1)
+            {
+                current[negId] += current[posId];
+            }
+            current[posId] = val;
+        }
+        else
+        {
             current[negId] = val;
-            conductance.row(negId) = new_conductance;
+        }
+    }
+    // the conductances Topology::check added from floating islands to ground
+    template <class Matrix>
+    static void stampShunts(Circuit::Schematic *schem, Matrix &conductance)
+    {
+        if (schem->shunts.empty())
+        {
             return;
         }
+        const double g = schem->getOption("gshunt", 1e-12);
+        for (Circuit::Node *node : schem->shunts)
+        {
+            addConductanceToMatrix(conductance, node->getId(), node->getId(), g);
+        }
     }
-    static void handleConductanceMatrixTwoNodes(Eigen::MatrixXd &conductance, int i, int j, double value)
+    template <class Matrix>
+    static void handleConductanceMatrixTwoNodes(Matrix &conductance, int i, int j, double value)
     {
         addConductanceToMatrix(conductance, i, i, value);
         addConductanceToMatrix(conductance, j, j, value);
         addConductanceToMatrix(conductance, i, j, -value);
         addConductanceToMatrix(conductance, j, i, -value);
     }
+    // the stamps of getConductanceOP and getConductanceTRAN, into a dense
+    // matrix or a list of triplets
+    template <class Matrix>
+    static void stampConductanceOP(Circuit::Schematic *schem, Matrix &conductance, Circuit::ParamTable *param);
+    template <class Matrix>
+    static void stampConductanceTRAN(Circuit::Schematic *schem, Matrix &conductance, Circuit::ParamTable *param, double step);
+    static void fromTriplets(Circuit::Schematic *schem, Eigen::SparseMatrix<double> &conductance);
 
 public:
     static void getCurrentOP(Circuit::Schematic *schem, Eigen::VectorXd &current, Eigen::MatrixXd &conductance, Circuit::ParamTable *param);
+    // the two halves of getCurrentOP, split so the operating point solver can
+    // scale the sources and add its own terms before the voltage source rows
+    // replace the KCL rows
+    static void getSourceCurrentOP(Circuit::Schematic *schem, Eigen::VectorXd &current, Circuit::ParamTable *param, double sourceScale = 1.0);
+    static void stampVoltageSourcesOP(Circuit::Schematic *schem, Eigen::MatrixXd &conductance, Eigen::VectorXd &current, Circuit::ParamTable *param, double sourceScale = 1.0);
     static void getCurrentTRAN(Circuit::Schematic *schem, Eigen::VectorXd &current, Eigen::MatrixXd &conductance, Circuit::ParamTable *param, double t, double step);
+    // the right hand side of getCurrentTRAN alone, for solvers that keep the
+    // matrix factorised
+    static void getCurrentTRAN(Circuit::Schematic *schem, Eigen::VectorXd &current, Circuit::ParamTable *param, double t, double step);
+    // the matrix half of getCurrentTRAN, for right hand sides assembled with
+    // the overload above
+    static void stampVoltageSourceRows(Circuit::Schematic *schem, Eigen::MatrixXd &conductance);
+    // the row operations the voltage sources make on the system, applied to a
+    // vector: a stamp a b^T of the conductance matrix ends up as (R a) b^T
+    static void applyVoltageSourceRows(Circuit::Schematic *schem, Eigen::VectorXd &vec);
     static void getConductanceOP(Circuit::Schematic *schem, Eigen::MatrixXd &conductance, Circuit::ParamTable *param);
     static void getConductanceTRAN(Circuit::Schematic *schem, Eigen::MatrixXd &conductance, Circuit::ParamTable *param, double t, double step);
     static void solveMatrix(const Eigen::MatrixXd &conductance, Eigen::VectorXd &voltage, const Eigen::VectorXd &current);
+    // one factorisation for every column of current
+    static void solveMatrix(const Eigen::MatrixXd &conductance, Eigen::MatrixXd &voltage, const Eigen::MatrixXd &current);
+
+    // Systems of sparseMinSize nodes and up are assembled straight into a
+    // sparse matrix with the overloads below, so their assembly time and
+    // memory grow with the number of nonzeros instead of the square of the
+    // size. Those the dense fixed size solve takes stay dense.
+    static bool assemblesSparse(int size)
+    {
+        return size > DENSE_MAX_SIZE && size >= sparseMinSize;
+    }
+    static void setSparseAssembly(int minSize)
+    {
+        sparseMinSize = minSize;
+    }
+    static void stampVoltageSourcesOP(Circuit::Schematic *schem, Eigen::SparseMatrix<double> &conductance, Eigen::VectorXd &current, Circuit::ParamTable *param, double sourceScale = 1.0);
+    static void getCurrentTRAN(Circuit::Schematic *schem, Eigen::VectorXd &current, Eigen::SparseMatrix<double> &conductance, Circuit::ParamTable *param, double t, double step);
+    static void stampVoltageSourceRows(Circuit::Schematic *schem, Eigen::SparseMatrix<double> &conductance);
+    static void getConductanceOP(Circuit::Schematic *schem, Eigen::SparseMatrix<double> &conductance, Circuit::ParamTable *param);
+    static void getConductanceTRAN(Circuit::Schematic *schem, Eigen::SparseMatrix<double> &conductance, Circuit::ParamTable *param, double t, double step);
+    static void solveMatrix(const Eigen::SparseMatrix<double> &conductance, Eigen::VectorXd &voltage, const Eigen::VectorXd &current);
+    static void solveMatrix(const Eigen::SparseMatrix<double> &conductance, Eigen::MatrixXd &voltage, const Eigen::MatrixXd &current);
+    static void setThreads(unsigned int n)
+    {
+        settings.setThreads(n);
+        settingsVersion++;
+    }
+    // caps the threads the solves of the calling thread spread over, for
+    // threads that already run in parallel with others; 0 lifts the cap
+    static void setThreadLimit(unsigned int n)
+    {
+        if (n != threadLimit)
+        {
+            threadLimit = n;
+            solverVersion = -1;
+        }
+    }
+    static unsigned int getThreadLimit()
+    {
+        return threadLimit;
+    }
+    static void setLinearSolver(BlockSolver::Method method, double tol, int iterativeMinSize, int parallelMinSize)
+    {
+        settings.setMethod(method, tol, iterativeMinSize, parallelMinSize);
+        settingsVersion++;
+    }
+    static void setEquilibration(bool on)
+    {
+        settings.setEquilibration(on);
+        settingsVersion++;
+    }
+    static void setMixedPrecision(bool on)
+    {
+        settings.setMixedPrecision(on);
+        settingsVersion++;
+    }
     static void init_vector(Eigen::VectorXd &vec, double val = 0.0)
     {
         for (int i = 0; i < vec.rows(); i++)
@@ -114,23 +325,32 @@ public:
 };
 
 void Circuit::Math::getCurrentOP(Circuit::Schematic *schem, Eigen::VectorXd &current, Eigen::MatrixXd &conductance, Circuit::ParamTable *param)
+{
+    getSourceCurrentOP(schem, current, param);
+    stampVoltageSourcesOP(schem, conductance, current, param);
+}
+
+void Circuit::Math::getSourceCurrentOP(Circuit::Schematic *schem, Eigen::VectorXd &current, Circuit::ParamTable *param, double sourceScale)
 {
     init_vector(current);
     std::for_each(schem->comps.begin(), schem->comps.end(), [&](std::pair<std::string, Circuit::Component *> comp) {
         if (Circuit::Current *source = dynamic_cast<Circuit::Current *>(comp.second))
         {
-            handleCurrentSource(current, source->getPosNode()->getId(), source->getNegNode()->getId(), source->getSourceOutput(param, 0));
+            handleCurrentSource(current, source->getPosNode()->getId(), source->getNegNode()->getId(), sourceScale * source->getSourceOutput(param, 0));
         }
         else if (Circuit::Capacitor *source = dynamic_cast<Circuit::Capacitor *>(comp.second))
         {
             handleCurrentSource(current, source->getPosNode()->getId(), source->getNegNode()->getId(), source->getOpReplace()->getSourceOutput(param, 0));
         }
     });
+}
 
+void Circuit::Math::stampVoltageSourcesOP(Circuit::Schematic *schem, Eigen::MatrixXd &conductance, Eigen::VectorXd &current, Circuit::ParamTable *param, double sourceScale)
+{
     std::for_each(schem->comps.begin(), schem->comps.end(), [&](std::pair<std::string, Circuit::Component *> comp) {
         if (Circuit::Voltage *source = dynamic_cast<Circuit::Voltage *>(comp.second))
         {
-            handleVoltageSource(conductance, current, source->getPosNode()->getId(), source->getNegNode()->getId(), source->getSourceOutput(param, 0));
+            handleVoltageSource(conductance, current, source->getPosNode()->getId(), source->getNegNode()->getId(), sourceScale * source->getSourceOutput(param, 0));
         }
         else if (Circuit::Inductor *source = dynamic_cast<Circuit::Inductor *>(comp.second))
         {
@@ -140,6 +360,22 @@ void Circuit::Math::getCurrentOP(Circuit::Schematic *schem, Eigen::VectorXd &cur
 }
 
 void Circuit::Math::getCurrentTRAN(Circuit::Schematic *schem, Eigen::VectorXd &current, Eigen::MatrixXd &conductance, Circuit::ParamTable *param, double t, double step)
+{
+    getCurrentTRAN(schem, current, param, t, step);
+    stampVoltageSourceRows(schem, conductance);
+}
+
+void Circuit::Math::stampVoltageSourceRows(Circuit::Schematic *schem, Eigen::MatrixXd &conductance)
+{
+    std::for_each(schem->comps.begin(), schem->comps.end(), [&](std::pair<std::string, Circuit::Component *> comp) {
+        if (Circuit::Voltage *source = dynamic_cast<Circuit::Voltage *>(comp.second))
+        {
+            handleVoltageSourceRows(conductance, source->getPosNode()->getId(), source->getNegNode()->getId());
+        }
+    });
+}
+
+void Circuit::Math::getCurrentTRAN(Circuit::Schematic *schem, Eigen::VectorXd &current, Circuit::ParamTable *param, double t, double step)
 {
     init_vector(current);
 
@@ -158,10 +394,25 @@ void Circuit::Math::getCurrentTRAN(Circuit::Schematic *schem, Eigen::VectorXd &c
         }
     });
 
+    for (Circuit::Component *comp : schem->macromodels)
+    {
+        static_cast<Circuit::Macromodel *>(comp)->stampCurrent(current, t, step);
+    }
+
+    std::for_each(schem->comps.begin(), schem->comps.end(), [&](std::pair<std::string, Circuit::Component *> comp) {
+        if (Circuit::Voltage *source = dynamic_cast<Circuit::Voltage *>(comp.second))
+        {
+            handleVoltageSourceCurrent(current, source->getPosNode()->getId(), source->getNegNode()->getId(), source->getSourceOutput(param, t));
+        }
+    });
+}
+
+void Circuit::Math::applyVoltageSourceRows(Circuit::Schematic *schem, Eigen::VectorXd &vec)
+{
     std::for_each(schem->comps.begin(), schem->comps.end(), [&](std::pair<std::string, Circuit::Component *> comp) {
         if (Circuit::Voltage *source = dynamic_cast<Circuit::Voltage *>(comp.second))
         {
-            handleVoltageSource(conductance, current, source->getPosNode()->getId(), source->getNegNode()->getId(), source->getSourceOutput(param, t));
+            handleVoltageSourceCurrent(vec, source->getPosNode()->getId(), source->getNegNode()->getId(), 0);
         }
     });
 }
@@ -169,7 +420,19 @@ void Circuit::Math::getCurrentTRAN(Circuit::Schematic *schem, Eigen::VectorXd &c
 void Circuit::Math::getConductanceOP(Circuit::Schematic *schem, Eigen::MatrixXd &conductance, Circuit::ParamTable *param)
 {
     init_matrix(conductance);
+    stampConductanceOP(schem, conductance, param);
+}
+
+void Circuit::Math::getConductanceOP(Circuit::Schematic *schem, Eigen::SparseMatrix<double> &conductance, Circuit::ParamTable *param)
+{
+    triplets.clear();
+    stampConductanceOP(schem, triplets, param);
+    fromTriplets(schem, conductance);
+}
 
+template <class Matrix>
+void Circuit::Math::stampConductanceOP(Circuit::Schematic *schem, Matrix &conductance, Circuit::ParamTable *param)
+{
     std::for_each(schem->comps.begin(), schem->comps.end(), [&](std::pair<std::string, Circuit::Component *> comp_pair) {
         if (!comp_pair.second->isSource())
         {
@@ -182,35 +445,169 @@ void Circuit::Math::getConductanceOP(Circuit::Schematic *schem, Eigen::MatrixXd
             handleConductanceMatrixTwoNodes(conductance, comp_pair.second->nodes[0]->getId(), comp_pair.second->nodes[1]->getId(), value);
         }
     });
+
+    for (Circuit::Component *comp : schem->macromodels)
+    {
+        static_cast<Circuit::Macromodel *>(comp)->stampConductance(conductance, -1);
+    }
+    stampShunts(schem, conductance);
 }
 
 void Circuit::Math::getConductanceTRAN(Circuit::Schematic *schem, Eigen::MatrixXd &conductance, Circuit::ParamTable *param, double t, double step)
 {
     init_matrix(conductance);
+    stampConductanceTRAN(schem, conductance, param, step);
+}
+
+void Circuit::Math::getConductanceTRAN(Circuit::Schematic *schem, Eigen::SparseMatrix<double> &conductance, Circuit::ParamTable *param, double t, double step)
+{
+    triplets.clear();
+    stampConductanceTRAN(schem, triplets, param, step);
+    fromTriplets(schem, conductance);
+}
 
+template <class Matrix>
+void Circuit::Math::stampConductanceTRAN(Circuit::Schematic *schem, Matrix &conductance, Circuit::ParamTable *param, double step)
+{
     std::for_each(schem->comps.begin(), schem->comps.end(), [&](std::pair<std::string, Circuit::Component *> comp_pair) {
         if (!comp_pair.second->isSource())
         {
-            if (t == 0)
-            {
-                step = 0;
-            }
             double value = comp_pair.second->getConductance(param, step);
             handleConductanceMatrixTwoNodes(conductance, comp_pair.second->nodes[0]->getId(), comp_pair.second->nodes[1]->getId(), value);
         }
     });
+
+    for (Circuit::Component *comp : schem->macromodels)
+    {
+        static_cast<Circuit::Macromodel *>(comp)->stampConductance(conductance, step);
+    }
+    stampShunts(schem, conductance);
 }
 
-Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::COLAMDOrdering<int>> Circuit::Math::solver;
-Eigen::SparseMatrix<double> Circuit::Math::sparse;
+Circuit::BlockSolver Circuit::Math::settings;
+int Circuit::Math::settingsVersion = 0;
+thread_local Circuit::BlockSolver Circuit::Math::solver;
+thread_local int Circuit::Math::solverVersion = -1;
+thread_local unsigned int Circuit::Math::threadLimit = 0;
+thread_local Eigen::SparseMatrix<double> Circuit::Math::sparse;
+thread_local std::vector<Eigen::Triplet<double>> Circuit::Math::triplets;
+int Circuit::Math::sparseMinSize = 17;
+
+// Duplicates are summed in the order they were stamped, the order a dense
+// assembly adds them in, and the zeros sparseView would drop are pruned, so
+// the system is the one the dense path would solve.
+void Circuit::Math::fromTriplets(Circuit::Schematic *schem, Eigen::SparseMatrix<double> &conductance)
+{
+    const int NUM_NODES = schem->nodes.size() - 1;
+    conductance.resize(NUM_NODES, NUM_NODES);
+    conductance.setFromTriplets(triplets.begin(), triplets.end());
+    conductance.prune(0.0);
+}
+
+void Circuit::Math::applySourceRows(const std::map<int, SourceRow> &rows, Eigen::SparseMatrix<double> &conductance)
+{
+    if (rows.empty())
+    {
+        return;
+    }
+    const Eigen::SparseMatrix<double, Eigen::RowMajor> kcl = conductance;
+    triplets.clear();
+    triplets.reserve(kcl.nonZeros());
+    for (int r = 0; r < kcl.outerSize(); r++)
+    {
+        std::map<int, SourceRow>::const_iterator row = rows.find(r);
+        if (row == rows.end())
+        {
+            for (Eigen::SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(kcl, r); it; ++it)
+            {
+                triplets.emplace_back(r, it.col(), it.value());
+            }
+            continue;
+        }
+        for (int k : row->second.kcl)
+        {
+            for (Eigen::SparseMatrix<double, Eigen::RowMajor>::InnerIterator it(kcl, k); it; ++it)
+            {
+                triplets.emplace_back(r, it.col(), it.value());
+            }
+        }
+        for (const std::pair<int, double> &entry : row->second.fixed)
+        {
+            triplets.emplace_back(r, entry.first, entry.second);
+        }
+    }
+    conductance.setFromTriplets(triplets.begin(), triplets.end());
+    conductance.prune(0.0);
+}
+
+void Circuit::Math::stampVoltageSourcesOP(Circuit::Schematic *schem, Eigen::SparseMatrix<double> &conductance, Eigen::VectorXd &current, Circuit::ParamTable *param, double sourceScale)
+{
+    std::map<int, SourceRow> rows;
+    std::for_each(schem->comps.begin(), schem->comps.end(), [&](std::pair<std::string, Circuit::Component *> comp) {
+        if (Circuit::Voltage *source = dynamic_cast<Circuit::Voltage *>(comp.second))
+        {
+            handleVoltageSourceRows(rows, source->getPosNode()->getId(), source->getNegNode()->getId());
+            handleVoltageSourceCurrent(current, source->getPosNode()->getId(), source->getNegNode()->getId(), sourceScale * source->getSourceOutput(param, 0));
+        }
+        else if (Circuit::Inductor *source = dynamic_cast<Circuit::Inductor *>(comp.second))
+        {
+            handleVoltageSourceRows(rows, source->getPosNode()->getId(), source->getNegNode()->getId());
+            handleVoltageSourceCurrent(current, source->getPosNode()->getId(), source->getNegNode()->getId(), source->getOpReplace()->getSourceOutput(param, 0));
+        }
+    });
+    applySourceRows(rows, conductance);
+}
+
+void Circuit::Math::getCurrentTRAN(Circuit::Schematic *schem, Eigen::VectorXd &current, Eigen::SparseMatrix<double> &conductance, Circuit::ParamTable *param, double t, double step)
+{
+    getCurrentTRAN(schem, current, param, t, step);
+    stampVoltageSourceRows(schem, conductance);
+}
+
+void Circuit::Math::stampVoltageSourceRows(Circuit::Schematic *schem, Eigen::SparseMatrix<double> &conductance)
+{
+    std::map<int, SourceRow> rows;
+    std::for_each(schem->comps.begin(), schem->comps.end(), [&](std::pair<std::string, Circuit::Component *> comp) {
+        if (Circuit::Voltage *source = dynamic_cast<Circuit::Voltage *>(comp.second))
+        {
+            handleVoltageSourceRows(rows, source->getPosNode()->getId(), source->getNegNode()->getId());
+        }
+    });
+    applySourceRows(rows, conductance);
+}
 
 void Circuit::Math::solveMatrix(const Eigen::MatrixXd &conductance, Eigen::VectorXd &voltage, const Eigen::VectorXd &current)
 {
+    if (conductance.rows() <= DENSE_MAX_SIZE)
+    {
+        solveFixed<DENSE_MAX_SIZE>(conductance, voltage, current);
+        return;
+    }
     sparse = conductance.sparseView();
     sparse.makeCompressed();
-    solver.analyzePattern(sparse);
-    solver.factorize(sparse);
-    voltage = solver.solve(current);
+    threadSolver().solve(sparse, current, voltage);
+}
+
+void Circuit::Math::solveMatrix(const Eigen::MatrixXd &conductance, Eigen::MatrixXd &voltage, const Eigen::MatrixXd &current)
+{
+    if (conductance.rows() <= DENSE_MAX_SIZE)
+    {
+        voltage = checkPivots(conductance.partialPivLu()).solve(current);
+        return;
+    }
+    sparse = conductance.sparseView();
+    sparse.makeCompressed();
+    threadSolver().solve(sparse, current, voltage);
+}
+
+void Circuit::Math::solveMatrix(const Eigen::SparseMatrix<double> &conductance, Eigen::VectorXd &voltage, const Eigen::VectorXd &current)
+{
+    threadSolver().solve(conductance, current, voltage);
+}
+
+void Circuit::Math::solveMatrix(const Eigen::SparseMatrix<double> &conductance, Eigen::MatrixXd &voltage, const Eigen::MatrixXd &current)
+{
+    threadSolver().solve(conductance, current, voltage);
 }
 
 #endif
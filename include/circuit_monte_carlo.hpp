@@ -0,0 +1,188 @@
+#ifndef GUARD_CIRCUIT_MONTE_CARLO_HPP
+#define GUARD_CIRCUIT_MONTE_CARLO_HPP
+
+#include <thread>
+
+// Runs the trials of a .mc analysis. The values of a trial depend on nothing
+// but its index (Sweep::fillTrial), so the trials are spread over the workers
+// of a Scheduler.
+//
+// The waveforms of the trials are not printed. For every .step point there is
+// one row per trial with the final value of every output column, followed by
+// the mean, standard deviation, minimum and maximum of those values over the
+// trials and, for transients, the lowest and highest value any trial reached.
+class Circuit::MonteCarlo
+{
+public:
+    typedef Simulator::Measurement Measurement;
+
+private:
+    Simulator *sim;
+    Schematic *schem;
+    std::vector<Measurement> results; // by run of the sweep, see Sweep::number
+
+    std::string title(Simulator::OutputFormat format) const;
+
+public:
+    MonteCarlo(Simulator *sim) : sim(sim), schem(sim->schem), results(sim->schem->sweep.size()) {}
+
+    // simulates every trial
+    void simulate(Simulator::OutputFormat format);
+
+    const Measurement &getResult(size_t run) const
+    {
+        return results[run];
+    }
+    // takes the result of a run simulated elsewhere, see Shards
+    void setResult(size_t run, const Measurement &m)
+    {
+        results[run] = m;
+    }
+
+    void print(std::ostream &dst, Simulator::OutputFormat format) const;
+
+    void run(std::ostream &dst, Simulator::OutputFormat format)
+    {
+        simulate(format);
+        print(dst, format);
+    }
+};
+
+std::string Circuit::MonteCarlo::title(Simulator::OutputFormat format) const
+{
+    std::stringstream &stream = sim->outputStream(format);
+    stream.str("");
+    if (format == Simulator::SPACE)
+    {
+        sim->spicePrintTitle();
+    }
+    else
+    {
+        sim->csvPrintTitle();
+    }
+    std::string text = stream.str();
+    stream.str("");
+    return text.replace(0, 4, "Trial");
+}
+
+void Circuit::MonteCarlo::simulate(Simulator::OutputFormat format)
+{
+    const size_t RUNS = results.size();
+    Scheduler scheduler(sim, std::min<size_t>(RUNS, schem->getOption("threads", std::thread::hardware_concurrency())));
+    scheduler.run(RUNS, [&](Simulator *worker, size_t i) {
+        std::ostream discard(nullptr);
+        worker->measuring = &results[i];
+        worker->runTable(i, discard, format);
+        worker->measuring = nullptr;
+    });
+    if (!sim->quiet)
+    {
+        std::cerr << std::endl
+                  << RUNS << " Monte Carlo runs on " << scheduler.workers() << " threads";
+    }
+    scheduler.report();
+}
+
+void Circuit::MonteCarlo::print(std::ostream &dst, Simulator::OutputFormat format) const
+{
+    const char separator = format == Simulator::CSV ? ',' : '\t';
+    const size_t trials = schem->sweep.trials();
+    const size_t points = schem->sweep.points();
+    const std::string header = title(format);
+    if (schem->sweep.number(0) == 0)
+    {
+        dst << "Monte Carlo: " << trials << " trials, seed " << schem->sweep.getSeed() << std::endl;
+    }
+
+    // the runs of every .step point in turn, a shard may hold only part of
+    // the trials of its first and last point
+    for (size_t begin = 0, end; begin < results.size(); begin = end)
+    {
+        const size_t p = schem->sweep.number(begin) / trials;
+        end = std::min(results.size(), (p + 1) * trials - schem->sweep.number(0));
+
+        ParamTable step;
+        schem->sweep.fillPoint(p, step);
+        if (step.lookup.size() > 0)
+        {
+            dst << "Step Information:";
+            for (std::pair<std::string, double> var : step.lookup)
+            {
+                dst << " " << var.first << "=" << var.second;
+            }
+            dst << " Run: " << p + 1 << "/" << points << std::endl;
+        }
+        dst << header;
+
+        std::vector<double> sum, squares, minimum, maximum, lowest, highest;
+        size_t count = 0;
+        for (size_t i = begin; i < end; i++)
+        {
+            const Measurement &m = results[i];
+            if (m.last.empty())
+            {
+                continue; // nothing was saved, e.g. a save start after the stop time
+            }
+            dst << schem->sweep.number(i) % trials + 1;
+            for (double v : m.last)
+            {
+                dst << separator << v;
+            }
+            dst << "\n";
+            if (count++ == 0)
+            {
+                sum.assign(m.last.size(), 0);
+                squares.assign(m.last.size(), 0);
+                minimum = maximum = m.last;
+                lowest = m.lowest;
+                highest = m.highest;
+            }
+            for (size_t j = 0; j < m.last.size(); j++)
+            {
+                sum[j] += m.last[j];
+                squares[j] += m.last[j] * m.last[j];
+                minimum[j] = std::min(minimum[j], m.last[j]);
+                maximum[j] = std::max(maximum[j], m.last[j]);
+                lowest[j] = std::min(lowest[j], m.lowest[j]);
+                highest[j] = std::max(highest[j], m.highest[j]);
+            }
+        }
+        if (count == 0)
+        {
+            continue;
+        }
+
+        std::vector<std::pair<std::string, std::vector<double>>> rows;
+        std::vector<double> mean(sum.size()), sigma(sum.size());
+        for (size_t j = 0; j < sum.size(); j++)
+        {
+            mean[j] = sum[j] / count;
+            sigma[j] = count > 1 ? std::sqrt(std::max(0.0, (squares[j] - count * mean[j] * mean[j]) / (count - 1))) : 0;
+        }
+        rows.push_back(std::make_pair("Mean", mean));
+        rows.push_back(std::make_pair("Sigma", sigma));
+        rows.push_back(std::make_pair("Min", minimum));
+        rows.push_back(std::make_pair("Max", maximum));
+        if (sim->type == Simulator::TRAN)
+        {
+            rows.push_back(std::make_pair("Lowest", lowest));
+            rows.push_back(std::make_pair("Highest", highest));
+        }
+        for (const std::pair<std::string, std::vector<double>> &row : rows)
+        {
+            dst << row.first;
+            for (double v : row.second)
+            {
+                dst << separator << v;
+            }
+            dst << "\n";
+        }
+    }
+}
+
+void Circuit::Simulator::runMonteCarlo(std::ostream &dst, OutputFormat format)
+{
+    MonteCarlo(this).run(dst, format);
+}
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef GUARD_CIRCUIT_NEWTON_HPP
+#define GUARD_CIRCUIT_NEWTON_HPP
+
+// Damped Newton iteration on the diode voltages x of the residual
+// F(x) = Vd(x) - x, shared by the operating point and the transient. Each
+// update is limited per junction with pnjlim and then halved until |F|
+// decreases. The iteration stops once every diode passes both the voltage
+// test |F| <= reltol * |v| + vntol and the current test
+// |I(x + F) - I(x)| <= reltol * |I| + abstol.
+//
+// Every Jacobian costs one circuit solve per diode, so by default it is kept
+// across iterations and solves (modified Newton). Each accepted step applies
+// a Broyden rank one update directly to the stored inverse
+// (Sherman-Morrison), and the Jacobian is only recomputed when a step from
+// the reused one fails to reduce |F| by maxRate.
+class Circuit::Newton
+{
+private:
+    Schematic *schem;
+    Eigen::VectorXd f;
+    Eigen::VectorXd fTrial;
+    Eigen::VectorXd fStep;
+    Eigen::VectorXd xTrial;
+    Eigen::VectorXd xStep;
+    Eigen::VectorXd dx;
+    Eigen::MatrixXd jac;
+    Eigen::MatrixXd jacInverse;
+    Eigen::FullPivLU<Eigen::MatrixXd> lu;
+    Eigen::VectorXd s;
+    Eigen::VectorXd y;
+    Eigen::VectorXd u;
+    Eigen::RowVectorXd w;
+    bool haveJacobian = false;
+    int iterations = 0;
+    unsigned long jacobians = 0;
+
+    // forward difference Jacobian around x, with the step floored at a volt's
+    // worth so it is not lost in the rounding of F near x = 0. F(x) is
+    // evaluated again without bypass so the differences are all exact.
+    template <typename Func>
+    bool computeJacobian(Func &func, const Eigen::VectorXd &x)
+    {
+        const double eps = std::sqrt(Eigen::NumTraits<double>::epsilon());
+        Diode::ExactEvaluation exact;
+        if (Diode::bypassing())
+        {
+            func(x, f);
+        }
+        xStep = x;
+        for (int j = 0; j < x.size(); j++)
+        {
+            double h = eps * std::max(std::abs(x[j]), 1.0);
+            xStep[j] += h;
+            func(xStep, fStep);
+            xStep[j] = x[j];
+            jac.col(j) = (fStep - f) / h;
+        }
+        jacobians++;
+        if (!jac.allFinite())
+        {
+            haveJacobian = false;
+            return false;
+        }
+        lu.compute(jac);
+        if (lu.isInvertible())
+        {
+            jacInverse = lu.inverse();
+        }
+        else
+        {
+            jacInverse = jac.completeOrthogonalDecomposition().pseudoInverse();
+        }
+        haveJacobian = true;
+        return true;
+    }
+
+    // limited Newton step from x into xTrial and fTrial
+    template <typename Func>
+    bool fullStep(Func &func, const Eigen::VectorXd &x)
+    {
+        dx.noalias() = -(jacInverse * f);
+        if (!dx.allFinite() || dx.isZero(0))
+        {
+            return false;
+        }
+        for (int i = 0; i < x.size(); i++)
+        {
+            dx[i] = schem->nonLinearComps[i]->limitVoltage(x[i] + dx[i], x[i]) - x[i];
+        }
+        xTrial = x + dx;
+        func(xTrial, fTrial);
+        return true;
+    }
+
+    // good Broyden update of the inverse for the step s = x1 - x0 with
+    // y = F(x1) - F(x0)
+    void broydenUpdate()
+    {
+        u.noalias() = jacInverse * y;
+        double denominator = s.dot(u);
+        if (!(std::abs(denominator) > 1e-300))
+        {
+            haveJacobian = false;
+            return;
+        }
+        u = s - u;
+        w.noalias() = s.transpose() * jacInverse;
+        jacInverse.noalias() += (u / denominator) * w;
+        if (!jacInverse.allFinite())
+        {
+            haveJacobian = false;
+        }
+    }
+
+    bool converged(const Eigen::VectorXd &x, const Eigen::VectorXd &f) const
+    {
+        for (int i = 0; i < x.size(); i++)
+        {
+            const Diode *d = schem->nonLinearComps[i];
+            double v = std::max(std::abs(x[i]), std::abs(x[i] + f[i]));
+            if (!(std::abs(f[i]) <= reltol * v + vntol))
+            {
+                return false;
+            }
+            double iOld = d->getJunctionCurrent(x[i]);
+            double iNew = d->getJunctionCurrent(x[i] + f[i]);
+            if (!(std::abs(iNew - iOld) <= reltol * std::max(std::abs(iOld), std::abs(iNew)) + abstol))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    double reltol;
+    double abstol;
+    double vntol;
+    int maxIterations;
+    int maxHalvings = 10;
+    bool reuse;
+    double maxRate;
+
+    Newton(Schematic *schem, int maxIterations)
+        : schem(schem), maxIterations(maxIterations)
+    {
+        const int n = schem->nonLinearComps.size();
+        f.resize(n);
+        fTrial.resize(n);
+        fStep.resize(n);
+        xTrial.resize(n);
+        xStep.resize(n);
+        dx.resize(n);
+        jac.resize(n, n);
+        jacInverse.resize(n, n);
+        s.resize(n);
+        y.resize(n);
+        u.resize(n);
+        w.resize(n);
+        reuse = schem->getOption("jacreuse", 1) != 0;
+        maxRate = schem->getOption("jacrate", 0.5);
+        reltol = schem->getOption("reltol", 1e-3);
+        abstol = schem->getOption("abstol", 1e-12);
+        vntol = schem->getOption("vntol", 1e-6);
+    }
+
+    // iterations taken by the last solve
+    int getIterations() const
+    {
+        return iterations;
+    }
+
+    // Jacobians computed over all solves
+    unsigned long getJacobians() const
+    {
+        return jacobians;
+    }
+
+    // Iterates from x, which is left at the last iterate. func(x, f) must
+    // write F(x) into f. Returns false if the iteration limit is reached or
+    // the residual stops being finite.
+    template <typename Func>
+    bool solve(Func &func, Eigen::VectorXd &x);
+};
+
+template <typename Func>
+bool Circuit::Newton::solve(Func &func, Eigen::VectorXd &x)
+{
+    iterations = 0;
+    func(x, f);
+    if (!f.allFinite())
+    {
+        return false;
+    }
+    if (converged(x, f))
+    {
+        return true;
+    }
+    if (!reuse)
+    {
+        haveJacobian = false;
+    }
+    double fNorm = f.norm();
+    while (iterations < maxIterations)
+    {
+        iterations++;
+        bool fresh = !haveJacobian;
+        if (fresh && !computeJacobian(func, x))
+        {
+            return false;
+        }
+        if (!fullStep(func, x))
+        {
+            haveJacobian = false;
+            return false;
+        }
+        // a step from a reused Jacobian that does not converge fast enough is
+        // redone with a fresh one
+        if (!fresh && !(fTrial.allFinite() && fTrial.norm() <= maxRate * fNorm))
+        {
+            fresh = true;
+            if (!computeJacobian(func, x) || !fullStep(func, x))
+            {
+                haveJacobian = false;
+                return false;
+            }
+        }
+
+        // backtrack until the residual decreases, keeping the shortest step
+        // if it never does
+        double alpha = 1;
+        for (int k = 0; k < maxHalvings && !(fTrial.allFinite() && fTrial.norm() <= (1 - 1e-4 * alpha) * fNorm); k++)
+        {
+            alpha /= 2;
+            xTrial = x + alpha * dx;
+            func(xTrial, fTrial);
+        }
+        if (!fTrial.allFinite())
+        {
+            haveJacobian = false;
+            return false;
+        }
+        if (reuse)
+        {
+            s = xTrial - x;
+            y = fTrial - f;
+            broydenUpdate();
+        }
+        x.swap(xTrial);
+        f.swap(fTrial);
+        fNorm = f.norm();
+        if (converged(x, f))
+        {
+            return true;
+        }
+    }
+    haveJacobian = false;
+    return false;
+}
+
+#endif
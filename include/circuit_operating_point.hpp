@@ -0,0 +1,533 @@
+#ifndef GUARD_CIRCUIT_OPERATING_POINT_HPP
+#define GUARD_CIRCUIT_OPERATING_POINT_HPP
+
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+// Nonlinear DC operating point. The diode voltages x are found as the fixed
+// point of F(x) = Vd(x) - x, where Vd(x) are the diode voltages of the linear
+// circuit with every diode linearised at x, the same formulation the transient
+// uses. Damped Newton (Circuit::Newton) is tried first; when it fails the
+// problem is made easier and walked back to the original one:
+//  - gmin stepping: a conductance from every node to ground, reduced to zero
+//  - source stepping: all sources ramped up from zero
+//  - pseudo-transient: a capacitor from every node to ground, integrated with
+//    a growing step until the circuit settles
+class Circuit::OperatingPoint
+{
+public:
+    enum Strategy
+    {
+        Failed,
+        Linear,
+        Newton,
+        GminStepping,
+        SourceStepping,
+        PseudoTransient
+    };
+
+    static const char *describe(Strategy strategy)
+    {
+        switch (strategy)
+        {
+        case Linear:
+            return "linear solve";
+        case Newton:
+            return "Newton";
+        case GminStepping:
+            return "gmin stepping";
+        case SourceStepping:
+            return "source stepping";
+        case PseudoTransient:
+            return "pseudo-transient";
+        default:
+            return "failed";
+        }
+    }
+
+private:
+    Schematic *schem;
+    ParamTable *param;
+    const int NUM_NODES;
+    const int NUM_DIODES;
+
+    // only one of these is assembled, see Math::assemblesSparse
+    const bool sparse;
+    Eigen::MatrixXd conductance;
+    Eigen::SparseMatrix<double> sparseConductance;
+    Eigen::VectorXd current;
+    Eigen::VectorXd voltage;
+    Eigen::VectorXd x;
+    Eigen::VectorXd xk;
+    Circuit::Newton solver;
+    Circuit::DiodeBank bank;
+    bool useBank;
+    std::vector<double> inductorCurrents;
+
+    // homotopy terms, all zero for the original circuit
+    double gshunt = 0;
+    double sourceScale = 1;
+    double ptranG = 0;
+    Eigen::VectorXd vPrev;
+
+    int iterations = 0;
+    Strategy strategy = Failed;
+
+    void solveLinear(const Eigen::VectorXd &vDiode);
+    void diodeVoltages(Eigen::VectorXd &vDiode) const;
+    void residual(const Eigen::VectorXd &vDiode, Eigen::VectorXd &f);
+    bool newton();
+    bool gminStepping();
+    bool sourceStepping();
+    bool pseudoTransient();
+    void solveInductorCurrents();
+    Strategy finish();
+
+public:
+    OperatingPoint(Schematic *schem, ParamTable *param)
+        : schem(schem), param(param), NUM_NODES(schem->nodes.size() - 1), NUM_DIODES(schem->nonLinearComps.size()),
+          sparse(Math::assemblesSparse(NUM_NODES)), conductance(sparse ? 0 : NUM_NODES, sparse ? 0 : NUM_NODES), current(NUM_NODES), voltage(NUM_NODES), x(NUM_DIODES), xk(NUM_DIODES),
+          solver(schem, schem->getOption("itl1", 100)), bank(schem->nonLinearComps), vPrev(NUM_NODES)
+    {
+        useBank = bank.size() >= schem->getOption("diodebank", 16);
+    }
+
+    // What solve found, enough to apply it to another copy of the circuit.
+    struct Solution
+    {
+        Strategy strategy;
+        int iterations;
+        Eigen::VectorXd x;
+    };
+
+    class Pipeline;
+
+    // Runs the strategies in turn until one converges.
+    Strategy solve();
+
+    // Takes the solution another OperatingPoint found for the same circuit
+    // and parameters instead of solving: only the final linear solve at the
+    // diode voltages is repeated, to linearise the diodes of this copy.
+    Strategy adopt(const Solution &solution);
+
+    Solution getSolution() const
+    {
+        return {strategy, iterations, x};
+    }
+
+    // Writes the solution into the schematic: node voltages, diode
+    // linearisation, and capacitor, inductor and macromodel states at rest, so
+    // a transient with the given timestep starts from equilibrium. A failed
+    // solve leaves the zero state instead.
+    void apply(double timestep);
+
+    int getIterations() const
+    {
+        return iterations;
+    }
+
+    const Eigen::VectorXd &getDiodeVoltages() const
+    {
+        return x;
+    }
+};
+
+void Circuit::OperatingPoint::solveLinear(const Eigen::VectorXd &vDiode)
+{
+    if (useBank)
+    {
+        bank.evaluate(vDiode);
+        bank.applyLinearisation();
+    }
+    else
+    {
+        for (int i = 0; i < NUM_DIODES; i++)
+        {
+            schem->nonLinearComps[i]->setConductance(param, -1, vDiode[i]);
+        }
+    }
+    Math::getSourceCurrentOP(schem, current, param, sourceScale);
+    if (gshunt + ptranG != 0)
+    {
+        current.noalias() += ptranG * vPrev;
+    }
+    if (sparse)
+    {
+        Math::getConductanceOP(schem, sparseConductance, param);
+        if (gshunt + ptranG != 0)
+        {
+            Eigen::SparseMatrix<double> shunt(NUM_NODES, NUM_NODES);
+            shunt.setIdentity();
+            sparseConductance += (gshunt + ptranG) * shunt;
+        }
+        Math::stampVoltageSourcesOP(schem, sparseConductance, current, param, sourceScale);
+    }
+    else
+    {
+        Math::getConductanceOP(schem, conductance, param);
+        if (gshunt + ptranG != 0)
+        {
+            conductance.diagonal().array() += gshunt + ptranG;
+        }
+        Math::stampVoltageSourcesOP(schem, conductance, current, param, sourceScale);
+    }
+    // a singular system fails the strategy through the non finite voltages
+    try
+    {
+        if (sparse)
+        {
+            Math::solveMatrix(sparseConductance, voltage, current);
+        }
+        else
+        {
+            Math::solveMatrix(conductance, voltage, current);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        voltage.setConstant(std::numeric_limits<double>::quiet_NaN());
+    }
+}
+
+void Circuit::OperatingPoint::diodeVoltages(Eigen::VectorXd &vDiode) const
+{
+    for (int i = 0; i < NUM_DIODES; i++)
+    {
+        int posId = schem->nonLinearComps[i]->getPosNode()->getId();
+        int negId = schem->nonLinearComps[i]->getNegNode()->getId();
+        vDiode[i] = (posId != -1 ? voltage[posId] : 0) - (negId != -1 ? voltage[negId] : 0);
+    }
+}
+
+void Circuit::OperatingPoint::residual(const Eigen::VectorXd &vDiode, Eigen::VectorXd &f)
+{
+    solveLinear(vDiode);
+    diodeVoltages(f);
+    f -= vDiode;
+}
+
+// Newton from the present x, which is only updated on success.
+bool Circuit::OperatingPoint::newton()
+{
+    xk = x;
+    auto F = [this](const Eigen::VectorXd &v, Eigen::VectorXd &f) {
+        residual(v, f);
+    };
+    bool ok = solver.solve(F, xk);
+    iterations += solver.getIterations();
+    if (ok)
+    {
+        x = xk;
+    }
+    return ok;
+}
+
+// Solves with a large shunt conductance on every node and takes it down to
+// zero, shrinking the reduction factor whenever a step fails.
+bool Circuit::OperatingPoint::gminStepping()
+{
+    const double gminStart = schem->getOption("gminstart", 1e-2);
+    const double gminStop = 1e-12;
+    double factor = 10;
+    x.setZero();
+    gshunt = gminStart;
+    if (!newton())
+    {
+        gshunt = 0;
+        return false;
+    }
+    Eigen::VectorXd xGood = x;
+    double gGood = gshunt;
+    while (gGood > 0)
+    {
+        gshunt = gGood / factor < gminStop ? 0 : gGood / factor;
+        if (newton())
+        {
+            xGood = x;
+            gGood = gshunt;
+            factor = std::min(factor * factor, 10.0);
+        }
+        else
+        {
+            x = xGood;
+            factor = std::sqrt(factor);
+            if (factor < 1.00005)
+            {
+                gshunt = 0;
+                return false;
+            }
+        }
+    }
+    gshunt = 0;
+    return true;
+}
+
+// Ramps every independent source from zero, where all diodes are off, up to
+// its full value.
+bool Circuit::OperatingPoint::sourceStepping()
+{
+    const double minStep = 1e-4;
+    double scaleGood = 0;
+    double step = 0.1;
+    x.setZero();
+    Eigen::VectorXd xGood = x;
+    while (scaleGood < 1)
+    {
+        sourceScale = std::min(1.0, scaleGood + step);
+        if (newton())
+        {
+            xGood = x;
+            scaleGood = sourceScale;
+            step = std::min(2 * step, 0.5);
+        }
+        else
+        {
+            x = xGood;
+            step /= 4;
+            if (step < minStep)
+            {
+                sourceScale = 1;
+                return false;
+            }
+        }
+    }
+    sourceScale = 1;
+    return true;
+}
+
+// Backward Euler steps of the circuit with a capacitor C from every node to
+// ground, starting from all nodes at zero. ptranG is C/h, halved (step
+// doubled) after each converged step until the capacitors no longer matter.
+bool Circuit::OperatingPoint::pseudoTransient()
+{
+    const int maxSteps = schem->getOption("ptranmaxsteps", 200);
+    x.setZero();
+    vPrev.setZero();
+    ptranG = schem->getOption("ptrang", 1e-2);
+    Eigen::VectorXd xGood = x;
+    for (int n = 0; n < maxSteps && ptranG > 1e-12; n++)
+    {
+        if (newton())
+        {
+            double change = (voltage - vPrev).lpNorm<Eigen::Infinity>();
+            xGood = x;
+            vPrev = voltage;
+            ptranG /= 2;
+            if (change < solver.vntol)
+            {
+                break;
+            }
+        }
+        else
+        {
+            x = xGood;
+            ptranG *= 8;
+            if (ptranG > 1e6)
+            {
+                break;
+            }
+        }
+    }
+    ptranG = 0;
+    return newton();
+}
+
+// The conductance matrix alone has no rows for inductor currents, so they are
+// recovered from KCL: the current the inductors and voltage sources must
+// carry into each node is the source current minus what flows out through
+// the conductances.
+void Circuit::OperatingPoint::solveInductorCurrents()
+{
+    std::vector<Component *> branches;
+    size_t numInductors = 0;
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        if (dynamic_cast<Inductor *>(comp.second))
+        {
+            branches.insert(branches.begin() + numInductors++, comp.second);
+        }
+        else if (dynamic_cast<Voltage *>(comp.second))
+        {
+            branches.push_back(comp.second);
+        }
+    }
+    inductorCurrents.assign(numInductors, 0);
+    if (numInductors == 0)
+    {
+        return;
+    }
+
+    Math::getSourceCurrentOP(schem, current, param);
+    Eigen::VectorXd r;
+    if (sparse)
+    {
+        Math::getConductanceOP(schem, sparseConductance, param);
+        r = current - sparseConductance * voltage;
+    }
+    else
+    {
+        Math::getConductanceOP(schem, conductance, param);
+        r = current - conductance * voltage;
+    }
+    Eigen::MatrixXd B = Eigen::MatrixXd::Zero(NUM_NODES, branches.size());
+    for (size_t k = 0; k < branches.size(); k++)
+    {
+        int posId = branches[k]->getPosNode()->getId();
+        int negId = branches[k]->getNegNode()->getId();
+        if (posId != -1)
+            B(posId, k) = 1.0;
+        if (negId != -1)
+            B(negId, k) = -1.0;
+    }
+    Eigen::VectorXd i = B.colPivHouseholderQr().solve(r);
+    for (size_t k = 0; k < numInductors; k++)
+    {
+        inductorCurrents[k] = std::isfinite(i[k]) ? i[k] : 0;
+    }
+}
+
+Circuit::OperatingPoint::Strategy Circuit::OperatingPoint::solve()
+{
+    iterations = 0;
+    x.setZero();
+    if (NUM_DIODES == 0)
+    {
+        solveLinear(x);
+        strategy = voltage.allFinite() ? Linear : Failed;
+    }
+    else if (newton())
+    {
+        strategy = Newton;
+    }
+    else if (gminStepping())
+    {
+        strategy = GminStepping;
+    }
+    else if (sourceStepping())
+    {
+        strategy = SourceStepping;
+    }
+    else if (pseudoTransient())
+    {
+        strategy = PseudoTransient;
+    }
+    else
+    {
+        strategy = Failed;
+    }
+    return finish();
+}
+
+Circuit::OperatingPoint::Strategy Circuit::OperatingPoint::adopt(const Solution &solution)
+{
+    strategy = solution.strategy;
+    iterations = solution.iterations;
+    x = solution.x;
+    return finish();
+}
+
+Circuit::OperatingPoint::Strategy Circuit::OperatingPoint::finish()
+{
+    if (strategy == Failed)
+    {
+        x.setZero();
+        voltage.setZero();
+        inductorCurrents.clear();
+        return strategy;
+    }
+    // leave the diodes linearised at the solution
+    solveLinear(x);
+    solveInductorCurrents();
+    return strategy;
+}
+
+void Circuit::OperatingPoint::apply(double timestep)
+{
+    for (std::pair<std::string, Node *> node : schem->nodes)
+    {
+        if (node.second->getId() != -1)
+        {
+            node.second->voltage = voltage[node.second->getId()];
+        }
+    }
+    size_t k = 0;
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        if (Capacitor *c = dynamic_cast<Capacitor *>(comp.second))
+        {
+            c->setCurrent(param, timestep, 0);
+        }
+        else if (Inductor *l = dynamic_cast<Inductor *>(comp.second))
+        {
+            l->setCurrent(param, timestep, k < inductorCurrents.size() ? inductorCurrents[k] : 0);
+            k++;
+        }
+        else if (Diode *d = dynamic_cast<Diode *>(comp.second))
+        {
+            d->seedCapacitance(param, timestep);
+        }
+    }
+    for (Component *comp : schem->macromodels)
+    {
+        if (strategy == Failed)
+        {
+            static_cast<Macromodel *>(comp)->resetState();
+        }
+        else
+        {
+            static_cast<Macromodel *>(comp)->seedDC();
+        }
+    }
+}
+
+// Operating points of the runs of a sweep, handed from a .op analysis to a
+// .tran of the same netlist running at the same time (see Analyses). Both
+// solve the same DC problem for a run, so the transient waits for the
+// solution of its run instead of solving it again, while the .op analysis
+// goes on with the next runs.
+class Circuit::OperatingPoint::Pipeline
+{
+    std::mutex lock;
+    std::condition_variable published;
+    std::vector<std::unique_ptr<Solution>> solutions; // by run of the sweep
+    bool closed = false;
+
+public:
+    Pipeline(size_t runs) : solutions(runs) {}
+
+    void publish(size_t run, const OperatingPoint &op)
+    {
+        std::unique_ptr<Solution> solution(new Solution(op.getSolution()));
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            solutions[run].swap(solution);
+        }
+        published.notify_all();
+    }
+
+    // no more solutions will be published, waiting runs solve their own
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        published.notify_all();
+    }
+
+    // waits for the solution of run, false if it will never come
+    bool take(size_t run, Solution &solution)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        published.wait(guard, [&] { return closed || solutions[run]; });
+        if (!solutions[run])
+        {
+            return false;
+        }
+        solution = *solutions[run];
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,502 @@
+#ifndef GUARD_CIRCUIT_PARALLEL_LU_HPP
+#define GUARD_CIRCUIT_PARALLEL_LU_HPP
+
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+
+// Direct solver for one large irreducible block, spread over threads by
+// dissection. The node graph is bisected recursively into independent leaves
+// and a border made of the vertex separators, which orders the matrix in
+// bordered block diagonal form
+//   [ A11           A1S ]
+//   [      ...      ... ]
+//   [           App ApS ]
+//   [ AS1  ...  ASp ASS ]
+// The leaves are factorised with SparseLU on their own threads, each adds
+// its contribution ASi Aii^-1 AiS to the Schur complement of the border, and
+// the border is factorised as a dense matrix with Eigen's blocked LU. Pivoting
+// stays inside a leaf, so compute reports failure for a leaf or border that is
+// singular on its own and the caller falls back to a plain SparseLU.
+class Circuit::ParallelLU
+{
+private:
+    typedef Eigen::SparseMatrix<double> Matrix;
+    typedef Eigen::SparseLU<Matrix, Eigen::COLAMDOrdering<int>> LU;
+
+    // columns of the leaf's border coupling solved at once
+    static constexpr int SCHUR_CHUNK = 64;
+
+    struct Leaf
+    {
+        std::vector<int> index;    // global row/column of each local one
+        std::vector<int> cols;     // border columns coupled into the leaf
+        std::vector<int> rows;     // border rows the leaf couples into
+        Matrix A;                  // diagonal block
+        Matrix right;              // A(index, cols)
+        Matrix below;              // A(rows, index)
+        std::vector<std::pair<int, int>> values;      // (global value, value of A)
+        std::vector<std::pair<int, int>> rightValues; // (global value, value of right)
+        std::vector<std::pair<int, int>> belowValues; // (global value, value of below)
+        LU lu;
+        bool analyzed = false;
+        bool ok = false;
+        Eigen::MatrixXd schur; // below * A^-1 * right
+        Eigen::VectorXd rhs;
+        Eigen::VectorXd x;
+    };
+
+    ThreadPool &pool;
+    unsigned int threads;
+    std::vector<std::unique_ptr<Leaf>> leaves;
+    std::vector<int> border;                              // global index of each border row/column
+    std::vector<std::pair<int, std::pair<int, int>>> borderValues; // (global value, (row, column))
+    Eigen::MatrixXd schur;
+    Eigen::PartialPivLU<Eigen::MatrixXd> borderLU;
+    Eigen::VectorXd borderRhs;
+    Eigen::VectorXd borderX;
+    bool analyzed = false;
+
+    void forEachLeaf(const std::function<void(Leaf &)> &work)
+    {
+        std::atomic<size_t> next(0);
+        std::function<void()> worker = [&]() {
+            for (size_t k = next++; k < leaves.size(); k = next++)
+            {
+                work(*leaves[k]);
+            }
+        };
+        pool.run(std::min<size_t>(threads, leaves.size()), worker);
+    }
+
+    static std::vector<std::vector<int>> adjacency(const Matrix &A);
+    static void bisect(const std::vector<std::vector<int>> &adj, const std::vector<int> &set, std::vector<int> &mark, int label,
+                       std::vector<int> &first, std::vector<int> &second, std::vector<int> &separator);
+    void analyze(const Matrix &A);
+
+public:
+    // leaves smaller than this are not split further
+    int minLeafSize = 256;
+
+    // the leaves run on pool, which must outlive the solver
+    ParallelLU(ThreadPool &pool, unsigned int threads) : pool(pool), threads(std::max(1u, threads)) {}
+
+    // Factorises A, analysing its pattern on the first call. A must be
+    // compressed and keep the same pattern between calls.
+    bool compute(const Matrix &A);
+
+    bool solve(const Eigen::VectorXd &rhs, Eigen::VectorXd &x);
+};
+
+// pattern of A + A^T without the diagonal
+std::vector<std::vector<int>> Circuit::ParallelLU::adjacency(const Matrix &A)
+{
+    std::vector<std::vector<int>> adj(A.rows());
+    for (int j = 0; j < A.cols(); j++)
+    {
+        for (int p = A.outerIndexPtr()[j]; p < A.outerIndexPtr()[j + 1]; p++)
+        {
+            int i = A.innerIndexPtr()[p];
+            if (i != j)
+            {
+                adj[i].push_back(j);
+                adj[j].push_back(i);
+            }
+        }
+    }
+    for (std::vector<int> &a : adj)
+    {
+        std::sort(a.begin(), a.end());
+        a.erase(std::unique(a.begin(), a.end()), a.end());
+    }
+    return adj;
+}
+
+// Splits the nodes of set (those with mark == label) in two halves of a
+// breadth first order started from a pseudo-peripheral node, so the cut runs
+// along a level of the search. The nodes of the second half that touch the
+// first become the separator.
+void Circuit::ParallelLU::bisect(const std::vector<std::vector<int>> &adj, const std::vector<int> &set, std::vector<int> &mark, int label,
+                                 std::vector<int> &first, std::vector<int> &second, std::vector<int> &separator)
+{
+    const int visited = -label - 2;
+    std::vector<int> order;
+    order.reserve(set.size());
+    auto bfs = [&](int start) {
+        size_t head = order.size();
+        order.push_back(start);
+        mark[start] = visited;
+        while (head < order.size())
+        {
+            int v = order[head++];
+            for (int w : adj[v])
+            {
+                if (mark[w] == label)
+                {
+                    mark[w] = visited;
+                    order.push_back(w);
+                }
+            }
+        }
+    };
+    for (int start : set)
+    {
+        if (mark[start] != label)
+        {
+            continue;
+        }
+        // the last node reached from any start is a pseudo-peripheral one
+        size_t begin = order.size();
+        bfs(start);
+        int peripheral = order.back();
+        for (size_t k = begin; k < order.size(); k++)
+        {
+            mark[order[k]] = label;
+        }
+        order.resize(begin);
+        bfs(peripheral);
+    }
+
+    const size_t half = order.size() / 2;
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        mark[order[k]] = k < half ? label : visited;
+    }
+    for (size_t k = half; k < order.size(); k++)
+    {
+        int v = order[k];
+        bool touches = false;
+        for (int w : adj[v])
+        {
+            touches = touches || mark[w] == label;
+        }
+        (touches ? separator : second).push_back(v);
+    }
+    first.assign(order.begin(), order.begin() + half);
+    for (int v : order)
+    {
+        mark[v] = label;
+    }
+}
+
+void Circuit::ParallelLU::analyze(const Matrix &A)
+{
+    const int n = A.rows();
+    const std::vector<std::vector<int>> adj = adjacency(A);
+
+    // bisect until there is a leaf per thread, rounded up to a power of two
+    std::vector<std::vector<int>> sets(1);
+    for (int i = 0; i < n; i++)
+    {
+        sets[0].push_back(i);
+    }
+    std::vector<int> mark(n, 0);
+    border.clear();
+    while (sets.size() < threads)
+    {
+        std::vector<std::vector<int>> next;
+        bool splitAny = false;
+        for (size_t s = 0; s < sets.size(); s++)
+        {
+            if ((int)sets[s].size() < 2 * minLeafSize)
+            {
+                next.push_back(sets[s]);
+                continue;
+            }
+            std::vector<int> first, second, separator;
+            bisect(adj, sets[s], mark, s, first, second, separator);
+            if (first.empty() || second.empty())
+            {
+                next.push_back(sets[s]);
+                continue;
+            }
+            splitAny = true;
+            border.insert(border.end(), separator.begin(), separator.end());
+            for (int v : separator)
+            {
+                mark[v] = -1;
+            }
+            next.push_back(first);
+            next.push_back(second);
+        }
+        for (size_t s = 0; s < next.size(); s++)
+        {
+            for (int v : next[s])
+            {
+                mark[v] = s;
+            }
+        }
+        sets.swap(next);
+        if (!splitAny)
+        {
+            break;
+        }
+    }
+
+    // group: leaf of each node, -1 for the border; local: position in it
+    std::vector<int> &group = mark;
+    std::vector<int> local(n);
+    for (size_t b = 0; b < border.size(); b++)
+    {
+        group[border[b]] = -1;
+        local[border[b]] = b;
+    }
+    leaves.clear();
+    for (size_t s = 0; s < sets.size(); s++)
+    {
+        leaves.emplace_back(new Leaf);
+        leaves[s]->index = sets[s];
+        for (size_t i = 0; i < sets[s].size(); i++)
+        {
+            group[sets[s][i]] = s;
+            local[sets[s][i]] = i;
+        }
+    }
+
+    // border rows and columns each leaf is coupled to, in leaf numbering
+    std::vector<std::vector<int>> colOf(leaves.size()), rowOf(leaves.size());
+    std::vector<int> slot(border.size(), -1);
+    for (size_t s = 0; s < leaves.size(); s++)
+    {
+        Leaf &leaf = *leaves[s];
+        for (int v : leaf.index)
+        {
+            for (int p = A.outerIndexPtr()[v]; p < A.outerIndexPtr()[v + 1]; p++)
+            {
+                int i = A.innerIndexPtr()[p];
+                if (group[i] == -1)
+                {
+                    leaf.rows.push_back(local[i]);
+                }
+            }
+        }
+        for (int b : border)
+        {
+            for (int p = A.outerIndexPtr()[b]; p < A.outerIndexPtr()[b + 1]; p++)
+            {
+                if (group[A.innerIndexPtr()[p]] == (int)s)
+                {
+                    leaf.cols.push_back(local[b]);
+                    break;
+                }
+            }
+        }
+        std::sort(leaf.rows.begin(), leaf.rows.end());
+        leaf.rows.erase(std::unique(leaf.rows.begin(), leaf.rows.end()), leaf.rows.end());
+    }
+
+    // patterns of the leaf blocks and where every global value lands
+    std::vector<std::vector<Eigen::Triplet<double>>> diag(leaves.size()), right(leaves.size()), below(leaves.size());
+    std::vector<std::vector<int>> colSlot(leaves.size()), rowSlot(leaves.size());
+    for (size_t s = 0; s < leaves.size(); s++)
+    {
+        colSlot[s].assign(border.size(), -1);
+        rowSlot[s].assign(border.size(), -1);
+        for (size_t c = 0; c < leaves[s]->cols.size(); c++)
+        {
+            colSlot[s][leaves[s]->cols[c]] = c;
+        }
+        for (size_t r = 0; r < leaves[s]->rows.size(); r++)
+        {
+            rowSlot[s][leaves[s]->rows[r]] = r;
+        }
+    }
+    borderValues.clear();
+    for (int j = 0; j < A.cols(); j++)
+    {
+        for (int p = A.outerIndexPtr()[j]; p < A.outerIndexPtr()[j + 1]; p++)
+        {
+            int i = A.innerIndexPtr()[p];
+            int gi = group[i], gj = group[j];
+            if (gi >= 0 && gi == gj)
+            {
+                diag[gi].emplace_back(local[i], local[j], p);
+            }
+            else if (gi >= 0 && gj == -1)
+            {
+                right[gi].emplace_back(local[i], colSlot[gi][local[j]], p);
+            }
+            else if (gi == -1 && gj >= 0)
+            {
+                below[gj].emplace_back(rowSlot[gj][local[i]], local[j], p);
+            }
+            else if (gi == -1 && gj == -1)
+            {
+                borderValues.push_back({p, {local[i], local[j]}});
+            }
+            else
+            {
+                // two leaves coupled directly: the separators are broken
+                analyzed = false;
+                leaves.clear();
+                return;
+            }
+        }
+    }
+
+    // the triplet values carry the global value index, so after
+    // setFromTriplets the value array of each block is its own map
+    auto build = [](Matrix &M, int rows, int cols, const std::vector<Eigen::Triplet<double>> &t, std::vector<std::pair<int, int>> &map) {
+        M.resize(rows, cols);
+        M.setFromTriplets(t.begin(), t.end());
+        M.makeCompressed();
+        map.clear();
+        for (int k = 0; k < M.nonZeros(); k++)
+        {
+            map.emplace_back((int)M.valuePtr()[k], k);
+        }
+    };
+    for (size_t s = 0; s < leaves.size(); s++)
+    {
+        Leaf &leaf = *leaves[s];
+        const int size = leaf.index.size();
+        build(leaf.A, size, size, diag[s], leaf.values);
+        build(leaf.right, size, leaf.cols.size(), right[s], leaf.rightValues);
+        build(leaf.below, leaf.rows.size(), size, below[s], leaf.belowValues);
+        leaf.rhs.resize(size);
+        leaf.x.resize(size);
+    }
+    schur.resize(border.size(), border.size());
+    borderRhs.resize(border.size());
+    borderX.resize(border.size());
+    analyzed = true;
+}
+
+bool Circuit::ParallelLU::compute(const Matrix &A)
+{
+    if (!analyzed)
+    {
+        analyze(A);
+        if (!analyzed)
+        {
+            return false;
+        }
+    }
+
+    forEachLeaf([&](Leaf &leaf) {
+        for (const std::pair<int, int> &v : leaf.values)
+        {
+            leaf.A.valuePtr()[v.second] = A.valuePtr()[v.first];
+        }
+        for (const std::pair<int, int> &v : leaf.rightValues)
+        {
+            leaf.right.valuePtr()[v.second] = A.valuePtr()[v.first];
+        }
+        for (const std::pair<int, int> &v : leaf.belowValues)
+        {
+            leaf.below.valuePtr()[v.second] = A.valuePtr()[v.first];
+        }
+        if (!leaf.analyzed)
+        {
+            leaf.lu.analyzePattern(leaf.A);
+            leaf.analyzed = true;
+        }
+        leaf.lu.factorize(leaf.A);
+        leaf.ok = leaf.lu.info() == Eigen::Success;
+        if (!leaf.ok)
+        {
+            return;
+        }
+        // the border columns are solved a chunk at a time to bound the dense
+        // workspace
+        const int numCols = leaf.cols.size();
+        leaf.schur.resize(leaf.rows.size(), numCols);
+        Eigen::MatrixXd chunk;
+        for (int c = 0; c < numCols; c += SCHUR_CHUNK)
+        {
+            const int width = std::min(SCHUR_CHUNK, numCols - c);
+            chunk = Eigen::MatrixXd(leaf.right.middleCols(c, width));
+            chunk = leaf.lu.solve(chunk);
+            leaf.schur.middleCols(c, width).noalias() = leaf.below * chunk;
+        }
+        leaf.ok = leaf.schur.allFinite();
+    });
+
+    schur.setZero();
+    for (const std::pair<int, std::pair<int, int>> &v : borderValues)
+    {
+        schur(v.second.first, v.second.second) = A.valuePtr()[v.first];
+    }
+    for (std::unique_ptr<Leaf> &leaf : leaves)
+    {
+        if (!leaf->ok)
+        {
+            return false;
+        }
+        for (size_t c = 0; c < leaf->cols.size(); c++)
+        {
+            for (size_t r = 0; r < leaf->rows.size(); r++)
+            {
+                schur(leaf->rows[r], leaf->cols[c]) -= leaf->schur(r, c);
+            }
+        }
+    }
+    if (!border.empty())
+    {
+        // PartialPivLU goes on past a zero pivot, so a singular border is
+        // caught by its condition estimate instead
+        borderLU.compute(schur);
+        if (!borderLU.matrixLU().allFinite() || !(borderLU.rcond() > std::numeric_limits<double>::epsilon()))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Circuit::ParallelLU::solve(const Eigen::VectorXd &rhs, Eigen::VectorXd &x)
+{
+    // forward: leaves on their own, then the border
+    forEachLeaf([&](Leaf &leaf) {
+        for (size_t i = 0; i < leaf.index.size(); i++)
+        {
+            leaf.rhs[i] = rhs[leaf.index[i]];
+        }
+        leaf.x = leaf.lu.solve(leaf.rhs);
+    });
+    for (size_t b = 0; b < border.size(); b++)
+    {
+        borderRhs[b] = rhs[border[b]];
+    }
+    for (std::unique_ptr<Leaf> &leaf : leaves)
+    {
+        Eigen::VectorXd coupled = leaf->below * leaf->x;
+        for (size_t r = 0; r < leaf->rows.size(); r++)
+        {
+            borderRhs[leaf->rows[r]] -= coupled[r];
+        }
+    }
+    if (!border.empty())
+    {
+        borderX = borderLU.solve(borderRhs);
+    }
+
+    // back: every leaf again with the border known
+    x.resize(rhs.size());
+    forEachLeaf([&](Leaf &leaf) {
+        for (size_t i = 0; i < leaf.index.size(); i++)
+        {
+            leaf.rhs[i] = rhs[leaf.index[i]];
+        }
+        for (int c = 0; c < leaf.right.outerSize(); c++)
+        {
+            for (Matrix::InnerIterator it(leaf.right, c); it; ++it)
+            {
+                leaf.rhs[it.row()] -= it.value() * borderX[leaf.cols[c]];
+            }
+        }
+        leaf.x = leaf.lu.solve(leaf.rhs);
+        for (size_t i = 0; i < leaf.index.size(); i++)
+        {
+            x[leaf.index[i]] = leaf.x[i];
+        }
+    });
+    for (size_t b = 0; b < border.size(); b++)
+    {
+        x[border[b]] = borderX[b];
+    }
+    return x.allFinite();
+}
+
+#endif
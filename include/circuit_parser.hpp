@@ -19,14 +19,19 @@ private:
 			".step",
 			".tran",
 			".dc",
+			".options",
+			".probe",
+			".mc",
+			".tol",
 			".op"
 			".model"
 	};
 
 	static double parseVal(const std::string &value ){
-		std::size_t suffixPos =  value.find_first_not_of("0.123456789");
-		if( suffixPos == std::string::npos ){
-			return	std::stod( value );
+		std::size_t suffixPos = 0;
+		double num = std::stod( value, &suffixPos );
+		if( suffixPos == value.size() ){
+			return num;
 		}
 		std::string unitSuffix = value.substr(suffixPos, std::string::npos);
 		int mult;
@@ -57,8 +62,7 @@ private:
 			std::cerr << "Invalid Unit Suffix" << '\n';
 			assert(0);
 		}
-		std::string num = value.substr(0, suffixPos);
-		return std::stod(num) * pow(10, mult);
+		return num * pow(10, mult);
 	}
 
 	template <class SourceType>
@@ -91,13 +95,17 @@ private:
 			smallSignalAmp = parseVal( acM.str(1) );
 		}
 
-		//DC value already variable safe although not implemented
-		std::regex dc("(?:^(?:(?:[a-zA-Z.\\d]+ ){3}))([a-zA-Z.\\d]+)");
+		//DC value, either a number or a {variable} stepped by .step
+		std::regex dc("(?:^(?:(?:[a-zA-Z.\\d]+ ){3}))(\\{\\w+\\}|[a-zA-Z.\\d]+)");
 		std::smatch dcM;
+		std::string variableName;
 		if( regex_search( line, dcM, dc ) ){
 			if( std::isdigit(dcM.str(1)[0])){
 				DC = parseVal( dcM.str(1) );
 			}
+			else if( dcM.str(1)[0] == '{' ){
+				variableName = dcM.str(1).substr(1, dcM.str(1).size()-2);
+			}
 		}
 
 		//sine function variable safe although not implemented
@@ -116,7 +124,11 @@ private:
 			}
 		}
 
-		return new SourceType(name, DC, nodePos, nodeNeg, smallSignalAmp, SINE_DC_offset , SINE_amplitude,  SINE_frequency, schem );
+		SourceType *source = new SourceType(name, DC, nodePos, nodeNeg, smallSignalAmp, SINE_DC_offset , SINE_amplitude,  SINE_frequency, schem );
+		if( !variableName.empty() ){
+			source->setVariable( variableName );
+		}
+		return source;
 	}
 
 	static void addComponent( const std::string& comp, Circuit::Schematic* schem ){
@@ -337,42 +349,114 @@ private:
 		else if( params[0] == ".OP"){
 			schem->sims.push_back(new Simulator(schem, Circuit::Simulator::SimulationType::OP));
 		}
+		else if( params[0] == ".PROBE" ){
+			//NOTE probed nodes are kept by the reduction passes, accepts N001 or V(N001)
+			std::for_each(params.begin()+1, params.end(), [&schem](std::string node){
+				if( node.size() > 3 && std::tolower(node[0]) == 'v' && node[1] == '(' && node.back() == ')' ){
+					node = node.substr(2, node.size()-3);
+				}
+				schem->probes.insert(node);
+			});
+		}
+		else if( params[0] == ".MC" ){
+			//NOTE .mc <trials> [seed=<n>], the components given a .tol are drawn
+			//afresh for every trial, see applyTolerances
+			assert(params.size() >= 2 && "Monte Carlo - number of trials missing");
+			unsigned long seed = 1;
+			std::for_each(params.begin()+2, params.end(), [&seed](const std::string &opt){
+				if( opt.compare(0, 5, "seed=") == 0 ){
+					seed = std::stoul( opt.substr(5) );
+				}
+			});
+			schem->sweep.setTrials( parseVal( params[1] ), seed );
+		}
+		else if( params[0] == ".OPTIONS" || params[0] == ".OPTION" ){
+			//NOTE flags without a value (e.g. ".options ffwd") are stored as 1
+			std::for_each(params.begin()+1, params.end(), [&schem](const std::string &opt){
+				std::size_t eq = opt.find('=');
+				std::string key = opt.substr(0, eq);
+				std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+				if( eq == std::string::npos ){
+					schem->options[key] = 1.0;
+				}
+				else{
+					schem->options[key] = parseVal( opt.substr(eq+1) );
+				}
+			});
+		}
 
 	}
-	using TableIt = std::map<std::string, std::vector<double>>::const_iterator;
-	static std::vector<ParamTable *> buildParam(TableIt it,const TableIt end){
-		std::vector<ParamTable *> tables;
-		//REVIEW Need to change auto
-		std::for_each( it->second.begin(), it->second.end(), [&tables, &it, &end](const auto& x){
-			if(it==std::prev(end,1)){
-				ParamTable* p = new ParamTable();
-				p->lookup[it->first] = x;
-				tables.push_back(p);
-			}
-			else{
-				std::vector<ParamTable *> toAdd = buildParam(std::next(it,1),end);
-				std::for_each( toAdd.begin(), toAdd.end(), [&it, &x](auto& a){
-					a->lookup[it->first] = x;
-				});
-				tables.insert(tables.end(), toAdd.begin(), toAdd.end());
-			}
-		});
-		return tables;
 
+	// a tolerance as a fraction, either plain (0.05) or in percent (5%)
+	static double parseTolerance( const std::string& value ){
+		if( !value.empty() && value.back() == '%' ){
+			return parseVal( value.substr(0, value.size()-1) ) / 100;
+		}
+		return parseVal( value );
 	}
-	static std::vector<ParamTable *> paramGenerator(std::map<std::string, std::vector<double>> values){
-		TableIt varOne = values.begin();
-		const TableIt varEnd = values.end();
-		std::vector<ParamTable *> tables;
 
-		std::vector<ParamTable *> recursiveAdd = buildParam(varOne, varEnd);
-		tables.insert(tables.end(), recursiveAdd.begin(), recursiveAdd.end());
-
-		return tables;
+	//NOTE .tol R1 C1 dev=1% lot=5% dist=gauss|uniform gives every component
+	//named its own device deviation and the lot deviation shared by the
+	//command in each .mc trial, by making the value a variable of the sweep
+	static void applyTolerances( Circuit::Schematic* schem, std::ostream& reports ){
+		std::for_each(schem->simulationCommands.begin(), schem->simulationCommands.end(), [&schem, &reports](const std::string &cmd){
+			std::stringstream ss( cmd );
+			std::vector<std::string> params;
+			std::string param;
+			while(ss>>param){
+				params.push_back(param);
+			}
+			std::transform(params[0].begin()+1, params[0].end(), params[0].begin()+1, ::toupper);
+			if( params[0] != ".TOL" ){
+				return;
+			}
+			double device = 0;
+			double lot = 0;
+			bool gaussian = true;
+			std::vector<std::string> names;
+			std::for_each(params.begin()+1, params.end(), [&](const std::string &opt){
+				std::size_t eq = opt.find('=');
+				std::string key = opt.substr(0, eq);
+				std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+				if( eq == std::string::npos ){
+					names.push_back(opt);
+				}
+				else if( key == "dev" ){
+					device = parseTolerance( opt.substr(eq+1) );
+				}
+				else if( key == "lot" ){
+					lot = parseTolerance( opt.substr(eq+1) );
+				}
+				else if( key == "dist" ){
+					gaussian = std::tolower(opt[eq+1]) != 'u';
+				}
+			});
+			const int lotGroup = schem->sweep.addLot();
+			std::for_each(names.begin(), names.end(), [&](const std::string &name){
+				std::map<std::string, Component *>::iterator it = schem->comps.find(name);
+				if( it == schem->comps.end() ){
+					reports << "tolerance for unknown component " << name << " ignored" << std::endl;
+					return;
+				}
+				Component *comp = it->second;
+				if( !dynamic_cast<Resistor *>(comp) && !dynamic_cast<Capacitor *>(comp) && !dynamic_cast<Inductor *>(comp) && !comp->isSource() ){
+					reports << "tolerance for " << name << " ignored, only resistors, capacitors, inductors and sources take one" << std::endl;
+					return;
+				}
+				if( comp->isVariableDefined() ){
+					reports << "tolerance for " << name << " ignored, its value is the variable " << comp->getVariableName() << std::endl;
+					return;
+				}
+				const std::string variable = "tol:" + name;
+				schem->sweep.addTolerance( {variable, comp->getFixedValue(), device, lot, gaussian, lotGroup} );
+				comp->setVariable( variable );
+			});
+		});
 	}
 public:
 
-	static Circuit::Schematic* parse( std::istream& inputStream ){
+	//NOTE the netlist's warnings go to reports
+	static Circuit::Schematic* parse( std::istream& inputStream, std::ostream& reports = std::cerr ){
 		//NOTE
 		//Refer to
 		//https://web.stanford.edu/class/ee133/handouts/general/spice_ref.pdf for
@@ -384,10 +468,12 @@ public:
 		Circuit::Schematic *schem = new Schematic();
 		if( std::getline( inputStream, inputLine ) ){
 			schem->title = inputLine;
+			schem->netlist = inputLine + "\n";
 		}
 		bool endStatement = false;
 		bool stepped = false;
 		while( std::getline( inputStream, inputLine )){
+			schem->netlist += inputLine + "\n";
 			if( inputLine == ".END" || inputLine == ".end" ){
 				endStatement = true;
 				break;
@@ -400,11 +486,12 @@ public:
 			}
 		}
 		if(stepped){
-			schem->tables = paramGenerator(tableGenerator);
+			std::for_each( tableGenerator.begin(), tableGenerator.end(), [&schem](const std::pair<const std::string, std::vector<double>>& var){
+				schem->sweep.addVariable(var.first, var.second);
+			});
 		}
-		else{
-			ParamTable *param = new ParamTable();
-			schem->tables.push_back( param );
+		if( schem->sweep.trials() > 0 ){
+			applyTolerances( schem, reports );
 		}
 		assert( endStatement && "No end statement present in netlist");
 		return schem;
@@ -0,0 +1,656 @@
+#ifndef GUARD_CIRCUIT_REDUCTION_HPP
+#define GUARD_CIRCUIT_REDUCTION_HPP
+
+#include <complex>
+#include <numeric>
+#include <set>
+
+// Netlist passes that shrink the system before simulation. They are selected
+// with .options and keep every node named in a .probe command.
+class Circuit::Reduction
+{
+private:
+    // a linear subnetwork cut out of the schematic at its ports
+    struct Subnetwork
+    {
+        std::vector<Node *> ports;
+        std::vector<Node *> internal;
+        std::vector<Component *> elements;
+    };
+
+    // fixed valued R, L or C, the only elements that are folded into a model
+    static bool isReducible(const Component *comp)
+    {
+        return !comp->isVariableDefined() &&
+               (dynamic_cast<const Resistor *>(comp) || dynamic_cast<const Capacitor *>(comp) || dynamic_cast<const Inductor *>(comp));
+    }
+
+    // nodes the rest of the circuit depends on: probes and anything touching a
+    // source, nonlinear device or swept component
+    static bool isPort(Schematic *schem, const Node *node)
+    {
+        if (schem->probes.count(node->getName()))
+        {
+            return true;
+        }
+        return std::any_of(node->comps.begin(), node->comps.end(), [](Component *comp) {
+            return !isReducible(comp);
+        });
+    }
+
+    static int findRoot(std::vector<int> &parent, int i)
+    {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    // elements between a node being eliminated and one of its neighbours
+    struct Branch
+    {
+        Node *node;
+        size_t count = 0;
+        double g = 0;
+        double c = 0;
+        double invL = 0;
+    };
+
+    // smallest timestep and longest stop time over the transient analyses,
+    // false if there are none
+    static bool transientWindow(Schematic *schem, double &step, double &stop)
+    {
+        step = 0;
+        stop = 0;
+        for (Simulator *sim : schem->sims)
+        {
+            if (sim->type == Simulator::SimulationType::TRAN)
+            {
+                step = step == 0 ? sim->getTranStepTime() : std::min(step, sim->getTranStepTime());
+                stop = std::max(stop, sim->getTranStopTime());
+            }
+        }
+        return step != 0;
+    }
+
+    // I() columns a simplification took out of the output: the currents of
+    // merged elements now flow through (and are reported by) the element they
+    // were merged into, those of eliminated nodes' elements are gone
+    struct Columns
+    {
+        std::map<std::string, std::vector<std::string>> merged;
+        std::vector<std::string> removed;
+    };
+
+    static std::string listNames(const std::vector<std::string> &names)
+    {
+        const size_t shown = 10;
+        std::string list;
+        for (size_t i = 0; i < names.size() && i < shown; i++)
+        {
+            list += (i ? ", I(" : "I(") + names[i] + ")";
+        }
+        if (names.size() > shown)
+        {
+            list += " and " + std::to_string(names.size() - shown) + " more";
+        }
+        return list;
+    }
+
+    static std::string uniqueName(Schematic *schem, const std::string &prefix, int &counter)
+    {
+        std::string name;
+        do
+        {
+            name = prefix + "_s" + std::to_string(++counter);
+        } while (schem->comps.count(name));
+        return name;
+    }
+
+    static std::vector<Subnetwork> findSubnetworks(Schematic *schem);
+    static bool prima(Schematic *schem, const Subnetwork &net, double fmin, double fmax, Eigen::MatrixXd &Gr, Eigen::MatrixXd &Cr, Eigen::MatrixXd &Br);
+    static size_t mergeParallel(Schematic *schem, Columns &columns);
+    static bool eliminateNode(Schematic *schem, Node *node, double tauMax, size_t maxDegree, int &counter, Columns &columns);
+
+public:
+    // both report what they reduced to reports
+    static void simplify(Schematic *schem, std::ostream &reports = std::cerr);
+    static void prima(Schematic *schem, std::ostream &reports = std::cerr);
+
+    static void run(Schematic *schem, std::ostream &reports = std::cerr)
+    {
+        if (schem->getOption("simplify", 0) != 0)
+        {
+            simplify(schem, reports);
+        }
+        if (schem->getOption("prima", 0) != 0)
+        {
+            prima(schem, reports);
+        }
+    }
+};
+
+std::vector<Circuit::Reduction::Subnetwork> Circuit::Reduction::findSubnetworks(Schematic *schem)
+{
+    // the voltages of nodes removed by simplify are rebuilt from these, so
+    // they have to stay outside the models
+    std::set<std::string> referenced;
+    for (const std::pair<const std::string, EliminatedNode> &e : schem->eliminated)
+    {
+        for (const std::pair<std::string, double> &w : e.second.weights)
+        {
+            referenced.insert(w.first);
+        }
+    }
+
+    std::map<Node *, int> index;
+    std::vector<Node *> internal;
+    for (std::pair<std::string, Node *> node_pair : schem->nodes)
+    {
+        if (node_pair.second->getId() != -1 && !isPort(schem, node_pair.second) && !referenced.count(node_pair.first))
+        {
+            index[node_pair.second] = internal.size();
+            internal.push_back(node_pair.second);
+        }
+    }
+
+    std::vector<int> parent(internal.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        std::map<Node *, int>::iterator a = index.find(comp.second->getPosNode());
+        std::map<Node *, int>::iterator b = index.find(comp.second->getNegNode());
+        if (isReducible(comp.second) && a != index.end() && b != index.end())
+        {
+            parent[findRoot(parent, a->second)] = findRoot(parent, b->second);
+        }
+    }
+
+    std::map<int, Subnetwork> nets;
+    for (size_t i = 0; i < internal.size(); i++)
+    {
+        nets[findRoot(parent, i)].internal.push_back(internal[i]);
+    }
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        if (!isReducible(comp.second))
+        {
+            continue;
+        }
+        std::map<Node *, int>::iterator it = index.find(comp.second->getPosNode());
+        if (it == index.end())
+        {
+            it = index.find(comp.second->getNegNode());
+        }
+        if (it == index.end())
+        {
+            continue;
+        }
+        Subnetwork &net = nets[findRoot(parent, it->second)];
+        net.elements.push_back(comp.second);
+        for (Node *n : comp.second->nodes)
+        {
+            if (n->getId() != -1 && !index.count(n) && std::find(net.ports.begin(), net.ports.end(), n) == net.ports.end())
+            {
+                net.ports.push_back(n);
+            }
+        }
+    }
+
+    std::vector<Subnetwork> result;
+    for (std::pair<const int, Subnetwork> &net : nets)
+    {
+        result.push_back(net.second);
+    }
+    return result;
+}
+
+// Folds fixed resistors and capacitors sharing both nodes into the first of
+// them. Returns the number of elements removed.
+size_t Circuit::Reduction::mergeParallel(Schematic *schem, Columns &columns)
+{
+    std::map<std::pair<Node *, Node *>, Component *> resistors;
+    std::map<std::pair<Node *, Node *>, Component *> capacitors;
+    std::vector<Component *> merged;
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        const bool isResistor = dynamic_cast<Resistor *>(comp.second) != nullptr;
+        if (!isReducible(comp.second) || (!isResistor && !dynamic_cast<Capacitor *>(comp.second)))
+        {
+            continue;
+        }
+        std::pair<Node *, Node *> key = std::minmax(comp.second->getPosNode(), comp.second->getNegNode());
+        std::map<std::pair<Node *, Node *>, Component *> &seen = isResistor ? resistors : capacitors;
+        std::map<std::pair<Node *, Node *>, Component *>::iterator it = seen.find(key);
+        if (it == seen.end())
+        {
+            seen[key] = comp.second;
+            continue;
+        }
+        Component *keep = it->second;
+        if (isResistor)
+        {
+            keep->setFixedValue(1.0 / (1.0 / keep->getFixedValue() + 1.0 / comp.second->getFixedValue()));
+        }
+        else
+        {
+            keep->setFixedValue(keep->getFixedValue() + comp.second->getFixedValue());
+        }
+        merged.push_back(comp.second);
+        std::vector<std::string> &into = columns.merged[keep->name];
+        std::map<std::string, std::vector<std::string>>::iterator earlier = columns.merged.find(comp.first);
+        into.push_back(comp.first);
+        if (earlier != columns.merged.end())
+        {
+            into.insert(into.end(), earlier->second.begin(), earlier->second.end());
+            columns.merged.erase(earlier);
+        }
+    }
+    for (Component *comp : merged)
+    {
+        delete comp;
+    }
+    return merged.size();
+}
+
+// Removes an internal node built only from fixed R, L and C, replacing its
+// elements with equivalent ones between its neighbours:
+//  - a node hanging off a single neighbour carries no current and is dropped
+//  - two inductors or two capacitors in series are merged
+//  - otherwise the node is eliminated TICER style: the star of conductances
+//    g_i and capacitances c_i becomes a mesh with g_i g_j / G and
+//    (g_i c_j + g_j c_i) / G between every pair of neighbours, G = sum g_i.
+//    This is exact for purely resistive nodes and a good approximation when
+//    the node time constant sum c_i / G is below tauMax.
+bool Circuit::Reduction::eliminateNode(Schematic *schem, Node *node, double tauMax, size_t maxDegree, int &counter, Columns &columns)
+{
+    if (node->getId() == -1 || isPort(schem, node))
+    {
+        return false;
+    }
+
+    std::vector<Branch> branches;
+    size_t nR = 0, nC = 0, nL = 0;
+    for (Component *comp : node->comps)
+    {
+        Node *other = comp->getPosNode() == node ? comp->getNegNode() : comp->getPosNode();
+        if (other == node)
+        {
+            return false;
+        }
+        std::vector<Branch>::iterator b = std::find_if(branches.begin(), branches.end(), [other](const Branch &b) {
+            return b.node == other;
+        });
+        if (b == branches.end())
+        {
+            branches.push_back(Branch{other});
+            b = branches.end() - 1;
+        }
+        b->count++;
+        if (dynamic_cast<Resistor *>(comp))
+        {
+            b->g += 1.0 / comp->getFixedValue();
+            nR++;
+        }
+        else if (dynamic_cast<Capacitor *>(comp))
+        {
+            b->c += comp->getFixedValue();
+            nC++;
+        }
+        else
+        {
+            b->invL += 1.0 / comp->getFixedValue();
+            nL++;
+        }
+    }
+    for (const Branch &b : branches)
+    {
+        if (b.node->comps.size() == b.count)
+        {
+            return false; // the neighbour would be left without elements
+        }
+    }
+
+    EliminatedNode e;
+    if (branches.size() == 1)
+    {
+        e.weights.emplace_back(branches[0].node->getName(), 1.0);
+    }
+    else if (branches.size() != 2 && (nL > 0 || nR == 0))
+    {
+        return false;
+    }
+    else if (nL > 0)
+    {
+        if (nR > 0 || nC > 0)
+        {
+            return false;
+        }
+        const double La = 1.0 / branches[0].invL;
+        const double Lb = 1.0 / branches[1].invL;
+        new Inductor(uniqueName(schem, "L", counter), La + Lb, branches[0].node->getName(), branches[1].node->getName(), schem);
+        e.weights.emplace_back(branches[0].node->getName(), Lb / (La + Lb));
+        e.weights.emplace_back(branches[1].node->getName(), La / (La + Lb));
+    }
+    else if (nR == 0)
+    {
+        const double Ca = branches[0].c;
+        const double Cb = branches[1].c;
+        new Capacitor(uniqueName(schem, "C", counter), Ca * Cb / (Ca + Cb), branches[0].node->getName(), branches[1].node->getName(), schem);
+        e.weights.emplace_back(branches[0].node->getName(), Ca / (Ca + Cb));
+        e.weights.emplace_back(branches[1].node->getName(), Cb / (Ca + Cb));
+    }
+    else
+    {
+        double G = 0, C = 0;
+        for (const Branch &b : branches)
+        {
+            G += b.g;
+            C += b.c;
+        }
+        if (branches.size() > maxDegree || (C > 0 && C / G > tauMax))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < branches.size(); i++)
+        {
+            for (size_t j = i + 1; j < branches.size(); j++)
+            {
+                const double g = branches[i].g * branches[j].g / G;
+                const double c = (branches[i].g * branches[j].c + branches[j].g * branches[i].c) / G;
+                if (g > 0)
+                {
+                    new Resistor(uniqueName(schem, "R", counter), 1.0 / g, branches[i].node->getName(), branches[j].node->getName(), schem);
+                }
+                if (c > 0)
+                {
+                    new Capacitor(uniqueName(schem, "C", counter), c, branches[i].node->getName(), branches[j].node->getName(), schem);
+                }
+            }
+            e.weights.emplace_back(branches[i].node->getName(), branches[i].g / G);
+        }
+    }
+
+    const std::string name = node->getName();
+    std::vector<Component *> removed = node->comps;
+    for (Component *comp : removed)
+    {
+        std::map<std::string, std::vector<std::string>>::iterator earlier = columns.merged.find(comp->name);
+        columns.removed.push_back(comp->name);
+        if (earlier != columns.merged.end())
+        {
+            columns.removed.insert(columns.removed.end(), earlier->second.begin(), earlier->second.end());
+            columns.merged.erase(earlier);
+        }
+        delete comp; // the node goes with its last element
+    }
+    schem->eliminated[name] = e;
+    schem->eliminationOrder.push_back(name);
+    return true;
+}
+
+void Circuit::Reduction::simplify(Schematic *schem, std::ostream &reports)
+{
+    // approximate eliminations need a timestep to compare against, without a
+    // transient only the exact ones are made
+    double step, stop;
+    const double tauMax = transientWindow(schem, step, stop) ? schem->getOption("ticertol", 0.1) * step : 0;
+    const size_t maxDegree = schem->getOption("simplifymaxdegree", 3);
+
+    const size_t nodesBefore = schem->nodes.size();
+    const size_t compsBefore = schem->comps.size();
+    std::set<std::string> original;
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        original.insert(comp.first);
+    }
+    Columns columns;
+    int counter = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = mergeParallel(schem, columns) > 0;
+        std::vector<std::string> names;
+        for (std::pair<std::string, Node *> node_pair : schem->nodes)
+        {
+            names.push_back(node_pair.first);
+        }
+        for (const std::string &name : names)
+        {
+            std::map<std::string, Node *>::iterator it = schem->nodes.find(name);
+            if (it != schem->nodes.end() && eliminateNode(schem, it->second, tauMax, maxDegree, counter, columns))
+            {
+                changed = true;
+            }
+        }
+    }
+
+    if (schem->nodes.size() != nodesBefore || schem->comps.size() != compsBefore)
+    {
+        reports << "simplify: " << nodesBefore - schem->nodes.size() << " nodes removed, "
+                  << compsBefore << " elements reduced to " << schem->comps.size() << std::endl;
+        // only the columns of the netlist's own elements are worth a mention,
+        // not those of elements made along the way
+        const auto fromNetlist = [&original](std::vector<std::string> names) {
+            names.erase(std::remove_if(names.begin(), names.end(), [&original](const std::string &name) {
+                            return !original.count(name);
+                        }),
+                        names.end());
+            return names;
+        };
+        for (const std::pair<const std::string, std::vector<std::string>> &m : columns.merged)
+        {
+            const std::vector<std::string> names = fromNetlist(m.second);
+            if (!names.empty())
+            {
+                reports << "simplify: I(" << m.first << ") now includes the current of " << listNames(names)
+                          << ", dropped from the output" << std::endl;
+            }
+        }
+        const std::vector<std::string> removed = fromNetlist(columns.removed);
+        if (!removed.empty())
+        {
+            reports << "simplify: " << listNames(removed) << " dropped from the output with their nodes" << std::endl;
+        }
+        schem->renumberNodes();
+    }
+}
+
+// PRIMA: block Arnoldi on (G + s0 C)^-1 C from (G + s0 C)^-1 B, followed by a
+// congruence projection which keeps the reduced model passive. Blocks are added
+// until the reduced port impedance stops changing by more than primatol over
+// the frequencies the transient can resolve.
+bool Circuit::Reduction::prima(Schematic *schem, const Subnetwork &net, double fmin, double fmax, Eigen::MatrixXd &Gr, Eigen::MatrixXd &Cr, Eigen::MatrixXd &Br)
+{
+    const double tol = schem->getOption("primatol", 1e-3);
+    const int maxOrder = schem->getOption("primamaxorder", 100);
+    const int p = net.ports.size();
+
+    // unknowns: port voltages, internal voltages, inductor currents
+    std::map<Node *, int> index;
+    int n = 0;
+    for (Node *node : net.ports)
+    {
+        index[node] = n++;
+    }
+    for (Node *node : net.internal)
+    {
+        index[node] = n++;
+    }
+    for (Component *comp : net.elements)
+    {
+        if (dynamic_cast<Inductor *>(comp))
+        {
+            n++;
+        }
+    }
+
+    std::vector<Eigen::Triplet<double>> gTriplets;
+    std::vector<Eigen::Triplet<double>> cTriplets;
+    int branch = index.size();
+    for (Component *comp : net.elements)
+    {
+        int a = comp->getPosNode()->getId() == -1 ? -1 : index.at(comp->getPosNode());
+        int b = comp->getNegNode()->getId() == -1 ? -1 : index.at(comp->getNegNode());
+        if (Inductor *l = dynamic_cast<Inductor *>(comp))
+        {
+            if (a != -1)
+            {
+                gTriplets.emplace_back(a, branch, 1.0);
+                gTriplets.emplace_back(branch, a, -1.0);
+            }
+            if (b != -1)
+            {
+                gTriplets.emplace_back(b, branch, -1.0);
+                gTriplets.emplace_back(branch, b, 1.0);
+            }
+            cTriplets.emplace_back(branch, branch, l->getFixedValue());
+            branch++;
+            continue;
+        }
+        double value = dynamic_cast<Resistor *>(comp) ? 1.0 / comp->getFixedValue() : comp->getFixedValue();
+        std::vector<Eigen::Triplet<double>> &triplets = dynamic_cast<Resistor *>(comp) ? gTriplets : cTriplets;
+        if (a != -1)
+            triplets.emplace_back(a, a, value);
+        if (b != -1)
+            triplets.emplace_back(b, b, value);
+        if (a != -1 && b != -1)
+        {
+            triplets.emplace_back(a, b, -value);
+            triplets.emplace_back(b, a, -value);
+        }
+    }
+    Eigen::SparseMatrix<double> G(n, n);
+    Eigen::SparseMatrix<double> C(n, n);
+    G.setFromTriplets(gTriplets.begin(), gTriplets.end());
+    C.setFromTriplets(cTriplets.begin(), cTriplets.end());
+    Eigen::MatrixXd B = Eigen::MatrixXd::Identity(n, p);
+
+    double s0 = schem->getOption("primas0", 0);
+    Eigen::SparseLU<Eigen::SparseMatrix<double>, Eigen::COLAMDOrdering<int>> lu;
+    lu.compute(Eigen::SparseMatrix<double>(G + s0 * C));
+    if (lu.info() != Eigen::Success)
+    {
+        // no DC path to ground, expand around the slowest frequency the
+        // transient can see instead
+        s0 = 2.0 * M_PI * fmin;
+        lu.compute(Eigen::SparseMatrix<double>(G + s0 * C));
+    }
+    if (lu.info() != Eigen::Success)
+    {
+        return false;
+    }
+
+    std::vector<std::complex<double>> freqs;
+    for (int k = 0; k <= 6; k++)
+    {
+        freqs.push_back(std::complex<double>(0, 2.0 * M_PI * fmin * std::pow(fmax / fmin, k / 6.0)));
+    }
+
+    Eigen::MatrixXd V(n, 0);
+    Eigen::MatrixXd block = lu.solve(B);
+    std::vector<Eigen::MatrixXcd> Zprev;
+    while (V.cols() < maxOrder && block.cols() > 0)
+    {
+        // modified Gram-Schmidt, run twice, dropping deflated directions
+        int first = V.cols();
+        for (int j = 0; j < block.cols(); j++)
+        {
+            Eigen::VectorXd w = block.col(j);
+            double initial = w.norm();
+            for (int pass = 0; pass < 2; pass++)
+            {
+                for (int i = 0; i < V.cols(); i++)
+                {
+                    w -= V.col(i).dot(w) * V.col(i);
+                }
+            }
+            if (w.norm() > 1e-10 * initial && initial > 0)
+            {
+                V.conservativeResize(n, V.cols() + 1);
+                V.col(V.cols() - 1) = w / w.norm();
+            }
+        }
+        if (V.cols() == first)
+        {
+            break; // Krylov space exhausted, the model is exact
+        }
+
+        Gr = V.transpose() * (G * V);
+        Cr = V.transpose() * (C * V);
+        Br = V.transpose() * B;
+
+        std::vector<Eigen::MatrixXcd> Z;
+        double change = 0;
+        for (size_t f = 0; f < freqs.size(); f++)
+        {
+            Eigen::MatrixXcd Ms = Gr.cast<std::complex<double>>() + freqs[f] * Cr.cast<std::complex<double>>();
+            Z.push_back(Br.transpose().cast<std::complex<double>>() * Ms.fullPivLu().solve(Br.cast<std::complex<double>>()));
+            if (!Zprev.empty())
+            {
+                // entrywise, so weak transfer terms converge as well as the
+                // driving point impedances
+                double floor = 1e-6 * Z[f].norm();
+                for (int i = 0; i < p * p; i++)
+                {
+                    change = std::max(change, std::abs(Z[f](i) - Zprev[f](i)) / std::max(std::abs(Z[f](i)), floor));
+                }
+            }
+        }
+        if (!Zprev.empty() && change < tol)
+        {
+            break;
+        }
+        Zprev = Z;
+
+        Eigen::MatrixXd next = C * V.rightCols(V.cols() - first);
+        block = lu.solve(next);
+    }
+    return V.cols() > 0 && V.cols() < n - p;
+}
+
+void Circuit::Reduction::prima(Schematic *schem, std::ostream &reports)
+{
+    double step, stop;
+    if (!transientWindow(schem, step, stop))
+    {
+        return; // nothing to gain for operating points
+    }
+    const double fmin = 1.0 / stop;
+    const double fmax = 0.5 / step;
+    const size_t minNodes = schem->getOption("primaminnodes", 10);
+    Node *ground = schem->nodes.at("0");
+
+    std::vector<Subnetwork> nets = findSubnetworks(schem);
+    bool reduced = false;
+    for (const Subnetwork &net : nets)
+    {
+        // ground has to outlive the elements it loses
+        bool keepsGround = std::any_of(ground->comps.begin(), ground->comps.end(), [&net](Component *comp) {
+            return std::find(net.elements.begin(), net.elements.end(), comp) == net.elements.end();
+        });
+        Eigen::MatrixXd Gr, Cr, Br;
+        if (net.ports.empty() || net.internal.size() < minNodes || !keepsGround || !prima(schem, net, fmin, fmax, Gr, Cr, Br))
+        {
+            continue;
+        }
+
+        std::string name = "PRIMA" + std::to_string(schem->macromodels.size() + 1);
+        schem->macromodels.push_back(new Macromodel(name, net.ports, Gr, Cr, Br, schem));
+        for (Component *comp : net.elements)
+        {
+            delete comp;
+        }
+        reports << name << ": " << net.internal.size() << " internal nodes reduced to order " << Gr.rows()
+                  << " with " << net.ports.size() << " ports" << std::endl;
+        reduced = true;
+    }
+    if (reduced)
+    {
+        schem->renumberNodes();
+    }
+}
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef GUARD_CIRCUIT_SCHEDULER_HPP
+#define GUARD_CIRCUIT_SCHEDULER_HPP
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <chrono>
+#include <memory>
+
+// Runs the runs of a sweep on a set of workers, each with a Simulator of its
+// own: worker 0 uses the simulator it is given and every other worker a copy
+// of the schematic parsed from the same netlist, as the simulation state
+// lives in the nodes and components.
+//
+// Runs differ a lot in cost (Newton iterations depend on the parameters), so
+// they are balanced by work stealing. Every worker starts with a contiguous
+// range of runs in a deque of its own and takes them from the front, in run
+// order; a worker whose deque is empty steals from the back of the others'.
+// The runs are whole simulations, so a mutex per deque costs nothing next to
+// them.
+class Circuit::Scheduler
+{
+public:
+    struct WorkerStats
+    {
+        size_t runs = 0;
+        size_t stolen = 0;
+        double busy = 0; // seconds spent in runs
+    };
+
+private:
+    struct Worker
+    {
+        Simulator *sim;
+        std::mutex lock;
+        std::deque<size_t> runs;
+        WorkerStats stats;
+    };
+
+    Simulator *sim;
+    std::vector<Schematic *> copies;
+    std::vector<std::unique_ptr<Worker>> pool;
+    double wall = 0;
+    bool reporting = true; // off when the simulator was set quiet
+
+    bool take(size_t w, size_t &run, bool &stolen);
+    void work(size_t w, size_t count, std::atomic<size_t> &done, const std::function<void(Simulator *, size_t)> &task);
+
+public:
+    Scheduler(Simulator *sim, size_t workers);
+    ~Scheduler();
+
+    // a copy of schem parsed from its netlist, with the same shard of the
+    // sweep
+    static Schematic *replicate(const Schematic *schem);
+
+    size_t workers() const
+    {
+        return pool.size();
+    }
+
+    // calls task(simulator of the worker, run) for every run in [0, count),
+    // worker 0 on the calling thread
+    void run(size_t count, const std::function<void(Simulator *, size_t)> &task);
+
+    const WorkerStats &getStats(size_t w) const
+    {
+        return pool[w]->stats;
+    }
+
+    // prints the runs and utilisation of every worker to stderr, unless the
+    // simulator is quiet
+    void report() const;
+};
+
+Circuit::Schematic *Circuit::Scheduler::replicate(const Schematic *schem)
+{
+    // the copies would repeat every report made about the original, so they
+    // go to a stream without a buffer, which drops them
+    std::ostream quiet(nullptr);
+    std::istringstream netlist(schem->netlist);
+    Schematic *copy = Parser::parse(netlist, quiet);
+    Reduction::run(copy, quiet);
+    Topology::check(copy, quiet);
+    copy->sweep = schem->sweep; // the same shard of the runs
+    return copy;
+}
+
+Circuit::Scheduler::Scheduler(Simulator *sim, size_t workers) : sim(sim)
+{
+    Schematic *schem = sim->schem;
+    const size_t index = std::find(schem->sims.begin(), schem->sims.end(), sim) - schem->sims.begin();
+    for (size_t w = 0; w < std::max<size_t>(workers, 1); w++)
+    {
+        pool.emplace_back(new Worker);
+        if (w == 0)
+        {
+            pool[w]->sim = sim;
+        }
+        else
+        {
+            copies.push_back(replicate(schem));
+            pool[w]->sim = copies.back()->sims[index];
+            pool[w]->sim->publishing = sim->publishing;
+            pool[w]->sim->seeding = sim->seeding;
+        }
+    }
+}
+
+Circuit::Scheduler::~Scheduler()
+{
+    for (Schematic *copy : copies)
+    {
+        delete copy;
+    }
+}
+
+bool Circuit::Scheduler::take(size_t w, size_t &run, bool &stolen)
+{
+    {
+        std::lock_guard<std::mutex> guard(pool[w]->lock);
+        if (!pool[w]->runs.empty())
+        {
+            run = pool[w]->runs.front();
+            pool[w]->runs.pop_front();
+            stolen = false;
+            return true;
+        }
+    }
+    for (size_t k = 1; k < pool.size(); k++)
+    {
+        Worker &victim = *pool[(w + k) % pool.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.runs.empty())
+        {
+            run = victim.runs.back();
+            victim.runs.pop_back();
+            stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Circuit::Scheduler::work(size_t w, size_t count, std::atomic<size_t> &done, const std::function<void(Simulator *, size_t)> &task)
+{
+    Worker &worker = *pool[w];
+    // the workers already keep the threads busy, so each solves on its own
+    const unsigned int limit = Math::getThreadLimit();
+    if (pool.size() > 1)
+    {
+        Math::setThreadLimit(1);
+    }
+    size_t run;
+    bool stolen;
+    while (take(w, run, stolen))
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        task(worker.sim, run);
+        worker.stats.busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        worker.stats.runs++;
+        worker.stats.stolen += stolen;
+        const size_t finished = ++done;
+        if (w == 0 && reporting)
+        {
+            Math::progressBar(double(finished) / count, finished - 1, count);
+        }
+    }
+    Math::setThreadLimit(limit);
+}
+
+void Circuit::Scheduler::run(size_t count, const std::function<void(Simulator *, size_t)> &task)
+{
+    const size_t W = pool.size();
+    reporting = !sim->quiet;
+    for (size_t w = 0; w < W; w++)
+    {
+        pool[w]->stats = WorkerStats();
+        pool[w]->runs.clear();
+        for (size_t i = w * count / W; i < (w + 1) * count / W; i++)
+        {
+            pool[w]->runs.push_back(i);
+        }
+        pool[w]->sim->quiet = true;
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::atomic<size_t> done(0);
+    std::vector<std::thread> threads;
+    for (size_t w = 1; w < W; w++)
+    {
+        threads.emplace_back(&Scheduler::work, this, w, count, std::ref(done), std::cref(task));
+    }
+    work(0, count, done, task);
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+    wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t w = 0; w < W; w++)
+    {
+        pool[w]->sim->quiet = !reporting;
+    }
+}
+
+void Circuit::Scheduler::report() const
+{
+    if (!reporting)
+    {
+        return;
+    }
+    std::cerr << std::endl;
+    for (size_t w = 0; w < pool.size(); w++)
+    {
+        const WorkerStats &s = pool[w]->stats;
+        std::cerr << "worker " << w << ": " << s.runs << " runs (" << s.stolen << " stolen), "
+                  << int(wall > 0 ? 100 * s.busy / wall : 100) << "% busy" << std::endl;
+    }
+}
+
+// Runs of a .step sweep on the workers of a Scheduler. Each run is printed
+// into a buffer of its own, and the buffers are written to dst in run order
+// as soon as every run before them has finished.
+void Circuit::Simulator::runParallel(std::ostream &dst, OutputFormat format)
+{
+    const size_t RUNS = schem->sweep.size();
+    if (type != OP)
+    {
+        dst << outputStream(format).str();
+    }
+    outputStream(format).str("");
+
+    Scheduler scheduler(this, std::min<size_t>(RUNS, schem->getOption("threads", std::thread::hardware_concurrency())));
+    std::vector<std::string> output(RUNS);
+    std::vector<bool> finished(RUNS, false);
+    size_t next = 0;
+    std::mutex lock;
+    scheduler.run(RUNS, [&](Simulator *worker, size_t i) {
+        std::stringstream run;
+        worker->runTable(i, run, format);
+        std::lock_guard<std::mutex> guard(lock);
+        output[i] = run.str();
+        finished[i] = true;
+        for (; next < RUNS && finished[next]; next++)
+        {
+            dst << output[next];
+            std::string().swap(output[next]);
+        }
+    });
+    scheduler.report();
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef GUARD_CIRCUIT_SHARD_HPP
+#define GUARD_CIRCUIT_SHARD_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Splits the runs of a sweep over processes. Shard i of n simulates the
+// contiguous share of the runs Sweep::setShard gives it, on a copy of the
+// circuit made by fork, and sends what it prints back to the coordinator
+// through a pipe as binary records:
+//
+//     TEXT         output of a simulator for its file, as printed
+//     MEASUREMENT  last, lowest and highest values of a Monte Carlo run
+//     DONE         the shard finished every run
+//
+// The coordinator writes the text of shard 0 to the files as it arrives and
+// keeps the text of later shards until every shard before them has exited,
+// so the files hold the runs in the same order, Step Information included,
+// as a run in a single process. The Monte Carlo statistics need every trial
+// of a point, so the measurements are collected and printed once all shards
+// are done. A shard that crashes or is killed only loses its own runs.
+class Circuit::Shards
+{
+    enum Type : uint32_t
+    {
+        TEXT,
+        MEASUREMENT,
+        DONE
+    };
+
+    struct Record
+    {
+        uint32_t type;
+        uint32_t sim;  // index in Schematic::sims
+        uint64_t run;  // of the whole sweep, for MEASUREMENT
+        uint64_t size; // bytes of text or number of doubles that follow
+    };
+
+    // sends everything printed to it as TEXT records of one simulator
+    class RecordBuffer : public std::streambuf
+    {
+        int fd;
+        uint32_t sim;
+        char buffer[1 << 16];
+
+    protected:
+        int overflow(int c) override
+        {
+            if (sync() != 0)
+            {
+                return traits_type::eof();
+            }
+            if (c != traits_type::eof())
+            {
+                *pptr() = c;
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+        int sync() override
+        {
+            const size_t size = pptr() - pbase();
+            if (size > 0 && !send(fd, {TEXT, sim, 0, size}, pbase()))
+            {
+                return -1;
+            }
+            setp(buffer, buffer + sizeof(buffer));
+            return 0;
+        }
+
+    public:
+        RecordBuffer(int fd, uint32_t sim) : fd(fd), sim(sim)
+        {
+            setp(buffer, buffer + sizeof(buffer));
+        }
+    };
+
+    static bool writeAll(int fd, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            const ssize_t written = write(fd, data, size);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    static bool send(int fd, const Record &head, const void *payload)
+    {
+        const size_t bytes = head.type == MEASUREMENT ? head.size * sizeof(double) : head.size;
+        return writeAll(fd, reinterpret_cast<const char *>(&head), sizeof(head)) &&
+               writeAll(fd, static_cast<const char *>(payload), bytes);
+    }
+
+    static void runShard(Schematic *schem, size_t shard, size_t shards, int fd, Simulator::OutputFormat format);
+
+public:
+    // Simulates the runs of every simulator of schem in shards forked
+    // processes and writes the output of sims[s] to paths[s]. Returns false
+    // if a shard failed, in which case the files lack its runs.
+    static bool coordinate(Schematic *schem, size_t shards, const std::vector<std::string> &paths, Simulator::OutputFormat format);
+};
+
+void Circuit::Shards::runShard(Schematic *schem, size_t shard, size_t shards, int fd, Simulator::OutputFormat format)
+{
+    schem->sweep.setShard(shard, shards);
+    // the shards share the machine, so by default each takes its part of the
+    // threads
+    if (schem->options.find("threads") == schem->options.end())
+    {
+        schem->options["threads"] = std::max<size_t>(1, std::thread::hardware_concurrency() / shards);
+        Math::setThreads(schem->options["threads"]);
+    }
+    for (uint32_t s = 0; s < schem->sims.size(); s++)
+    {
+        Simulator *sim = schem->sims[s];
+        sim->setQuiet(true);
+        if (schem->sweep.trials() > 0)
+        {
+            MonteCarlo mc(sim);
+            mc.simulate(format);
+            for (size_t i = 0; i < schem->sweep.size(); i++)
+            {
+                const MonteCarlo::Measurement &m = mc.getResult(i);
+                std::vector<double> values(m.last);
+                values.insert(values.end(), m.lowest.begin(), m.lowest.end());
+                values.insert(values.end(), m.highest.begin(), m.highest.end());
+                if (!send(fd, {MEASUREMENT, s, schem->sweep.number(i), values.size()}, values.data()))
+                {
+                    _exit(1);
+                }
+            }
+        }
+        else
+        {
+            RecordBuffer buffer(fd, s);
+            std::ostream out(&buffer);
+            sim->run(out, format);
+            if (!out.flush())
+            {
+                _exit(1);
+            }
+        }
+    }
+    _exit(send(fd, {DONE, 0, 0, 0}, nullptr) ? 0 : 1);
+}
+
+bool Circuit::Shards::coordinate(Schematic *schem, size_t shards, const std::vector<std::string> &paths, Simulator::OutputFormat format)
+{
+    const size_t RUNS = schem->sweep.total();
+    shards = std::max<size_t>(1, std::min(shards, RUNS));
+
+    std::vector<pid_t> pids(shards, -1);
+    std::vector<pollfd> fds(shards);
+    for (size_t i = 0; i < shards; i++)
+    {
+        int ends[2];
+        if (pipe(ends) != 0)
+        {
+            std::cerr << "could not open a pipe for shard " << i << ": " << std::strerror(errno) << std::endl;
+            shards = i;
+            break;
+        }
+        std::cout.flush();
+        std::cerr.flush();
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(ends[0]);
+            for (size_t j = 0; j < i; j++)
+            {
+                close(fds[j].fd);
+            }
+            runShard(schem, i, shards, ends[1], format);
+        }
+        close(ends[1]);
+        if (pid < 0)
+        {
+            std::cerr << "could not start shard " << i << ": " << std::strerror(errno) << std::endl;
+            close(ends[0]);
+            shards = i;
+            break;
+        }
+        pids[i] = pid;
+        fds[i].fd = ends[0];
+        fds[i].events = POLLIN;
+    }
+    if (shards == 0)
+    {
+        return false;
+    }
+    pids.resize(shards);
+    fds.resize(shards);
+
+    std::vector<std::ofstream> files(schem->sims.size());
+    std::vector<std::unique_ptr<MonteCarlo>> mc(schem->sims.size());
+    for (size_t s = 0; s < schem->sims.size(); s++)
+    {
+        files[s].open(paths[s]);
+        if (schem->sweep.trials() > 0)
+        {
+            mc[s].reset(new MonteCarlo(schem->sims[s]));
+        }
+    }
+
+    // text of a shard that is not yet the next one to write, by simulator
+    std::vector<std::vector<std::string>> pending(shards, std::vector<std::string>(schem->sims.size()));
+    std::vector<std::string> inbox(shards);
+    std::vector<bool> finished(shards, false), clean(shards, false);
+    size_t next = 0, open = shards;
+    bool ok = true;
+    char chunk[1 << 16];
+
+    while (open > 0)
+    {
+        if (poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << "waiting on the shards failed: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        for (size_t i = 0; i < shards; i++)
+        {
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+            {
+                continue;
+            }
+            const ssize_t got = read(fds[i].fd, chunk, sizeof(chunk));
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got < 0)
+            {
+                // whatever the shard sends after this is lost, so it counts
+                // as failed
+                std::cerr << "reading shard " << i << "/" << shards << " failed: " << std::strerror(errno) << std::endl;
+                clean[i] = false;
+            }
+            if (got > 0)
+            {
+                inbox[i].append(chunk, got);
+            }
+
+            // every complete record so far
+            size_t at = 0;
+            while (inbox[i].size() - at >= sizeof(Record))
+            {
+                Record head;
+                std::memcpy(&head, inbox[i].data() + at, sizeof(head));
+                const size_t bytes = head.type == MEASUREMENT ? head.size * sizeof(double) : head.size;
+                if (inbox[i].size() - at - sizeof(head) < bytes)
+                {
+                    break;
+                }
+                const char *payload = inbox[i].data() + at + sizeof(head);
+                at += sizeof(head) + bytes;
+                if (head.sim >= schem->sims.size() && head.type != DONE)
+                {
+                    continue;
+                }
+                if (head.type == TEXT && i == next)
+                {
+                    files[head.sim].write(payload, bytes);
+                }
+                else if (head.type == TEXT)
+                {
+                    pending[i][head.sim].append(payload, bytes);
+                }
+                else if (head.type == MEASUREMENT && mc[head.sim] && head.run < RUNS)
+                {
+                    const size_t n = head.size / 3;
+                    const double *values = reinterpret_cast<const double *>(payload);
+                    MonteCarlo::Measurement m;
+                    m.last.assign(values, values + n);
+                    m.lowest.assign(values + n, values + 2 * n);
+                    m.highest.assign(values + 2 * n, values + 3 * n);
+                    mc[head.sim]->setResult(head.run, m);
+                }
+                else if (head.type == DONE)
+                {
+                    clean[i] = true;
+                }
+            }
+            inbox[i].erase(0, at);
+
+            if (got > 0)
+            {
+                continue;
+            }
+            // end of the pipe, the shard has exited, or a broken one, which
+            // the shard dies on with SIGPIPE at its next write
+            close(fds[i].fd);
+            fds[i].fd = -1;
+            open--;
+            int status = 0;
+            waitpid(pids[i], &status, 0);
+            finished[i] = true;
+            if (!clean[i] || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                std::cerr << "shard " << i << "/" << shards << " (runs " << i * RUNS / shards + 1 << " to "
+                          << (i + 1) * RUNS / shards << ") failed";
+                if (WIFSIGNALED(status))
+                {
+                    std::cerr << " with signal " << WTERMSIG(status);
+                }
+                std::cerr << ", its runs are missing from the output" << std::endl;
+                ok = false;
+            }
+            while (next < shards && finished[next])
+            {
+                next++;
+                for (size_t s = 0; next < shards && s < schem->sims.size(); s++)
+                {
+                    files[s] << pending[next][s];
+                    std::string().swap(pending[next][s]);
+                }
+            }
+        }
+    }
+
+    for (size_t s = 0; s < schem->sims.size(); s++)
+    {
+        if (mc[s])
+        {
+            mc[s]->print(files[s], format);
+        }
+        files[s].close();
+    }
+    return ok;
+}
+
+#endif
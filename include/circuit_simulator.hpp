@@ -3,9 +3,9 @@
 
 #include <sstream>
 #include <iostream>
+#include <cmath>
 #include <Eigen/Dense>
 #include <unsupported/Eigen/NonLinearOptimization>
-#include <unsupported/Eigen/NumericalDiff>
 
 template <typename _Scalar, int NX = Eigen::Dynamic, int NY = Eigen::Dynamic>
 struct Functor
@@ -41,52 +41,127 @@ struct ConductanceFunc : Functor<double>
 	Circuit::ParamTable *param;
 	double timestep;
 	int NUM_NODES = 0;
-	ConductanceFunc(Circuit::Schematic *schem, Circuit::ParamTable *param, double time, double timestep, int NUM_NODES) : Functor<double>(schem->nonLinearComps.size(), schem->nonLinearComps.size())
+
+	// workspaces shared by every evaluation, so the functor is built once per
+	// run and a timestep does not allocate
+	mutable Eigen::VectorXd voltage;
+	mutable Eigen::VectorXd current;
+	mutable Eigen::MatrixXd conductance;
+	mutable Eigen::SparseMatrix<double> sparseConductance;
+	bool sparse;
+	Eigen::VectorXd fBase;
+	Eigen::VectorXd fStep;
+	Eigen::VectorXd xStep;
+
+	// large diode counts are evaluated as one vectorised bank
+	mutable Circuit::DiodeBank bank;
+	bool useBank;
+	Eigen::VectorXd vStepStart;
+
+	// the linear part is factorised once and the diodes applied as a low rank
+	// correction, see LowRankSolver
+	mutable Circuit::LowRankSolver lowRank;
+	bool useLowRank;
+	bool lowRankReady = false;
+
+	ConductanceFunc(Circuit::Schematic *schem, Circuit::ParamTable *param, double time, double timestep, int NUM_NODES) : Functor<double>(schem->nonLinearComps.size(), schem->nonLinearComps.size()), bank(schem->nonLinearComps), lowRank(schem, param)
 	{
+		useBank = bank.size() >= schem->getOption("diodebank", 16);
+		useLowRank = schem->getOption("lowrank", 1) != 0;
+		vStepStart.resize(inputs());
 		this->schem = schem;
 		this->param = param;
 		this->timestep = timestep;
 		this->time = time;
 		this->NUM_NODES = NUM_NODES;
+		voltage.resize(NUM_NODES);
+		current.resize(NUM_NODES);
+		sparse = Circuit::Math::assemblesSparse(NUM_NODES);
+		if (!sparse)
+		{
+			conductance.resize(NUM_NODES, NUM_NODES);
+		}
+		fBase.resize(inputs());
+		fStep.resize(inputs());
+		xStep.resize(inputs());
 	}
 
-	int operator()(const Eigen::VectorXd &vDiff, Eigen::VectorXd &fvec) const
+	// the junction capacitances of a step only depend on the voltages at its
+	// start, so the bank evaluates them once here
+	void setTime(double time, double timestep)
 	{
-		Eigen::VectorXd voltage(NUM_NODES);
-		Eigen::VectorXd current(NUM_NODES);
-		Eigen::MatrixXd conductance(NUM_NODES, NUM_NODES);
-		for (int i = 0; i < vDiff.size(); i++)
+		this->time = time;
+		this->timestep = timestep;
+		if (useBank)
 		{
-			schem->nonLinearComps[i]->setConductance(param, timestep, vDiff(i));
+			for (int i = 0; i < vStepStart.size(); i++)
+			{
+				vStepStart[i] = schem->nonLinearComps[i]->getVoltage();
+			}
+			bank.evaluate(vStepStart);
+			bank.applyCapacitance(param, timestep);
 		}
-		Circuit::Math::getConductanceTRAN(schem, conductance, param, time, timestep);
-		Circuit::Math::getCurrentTRAN(schem, current, conductance, param, time, timestep);
-		Circuit::Math::solveMatrix(conductance, voltage, current);
+		lowRankReady = useLowRank && lowRank.prepare(time, timestep, conductance, current);
+	}
 
-		for (int i = 0; i < vDiff.size(); i++)
+	// linearises every diode at vDiff
+	void linearise(const Eigen::VectorXd &vDiff) const
+	{
+		if (useBank)
 		{
-			double vPos = (schem->nonLinearComps[i]->getPosNode()->getId() != -1) ? voltage(schem->nonLinearComps[i]->getPosNode()->getId()) : 0;
-			double vNeg = (schem->nonLinearComps[i]->getNegNode()->getId() != -1) ? voltage(schem->nonLinearComps[i]->getNegNode()->getId()) : 0;
-			fvec(i) = vPos - vNeg - vDiff(i);
+			bank.evaluate(vDiff);
+			bank.applyLinearisation();
+		}
+		else
+		{
+			for (int i = 0; i < vDiff.size(); i++)
+			{
+				schem->nonLinearComps[i]->setConductance(param, timestep, vDiff(i));
+			}
 		}
+	}
 
+	// solves the linearised circuit with the diodes at vDiff, result in voltage
+	void solve(const Eigen::VectorXd &vDiff) const
+	{
+		linearise(vDiff);
+		try
+		{
+			if (sparse)
+			{
+				Circuit::Math::getConductanceTRAN(schem, sparseConductance, param, time, timestep);
+				Circuit::Math::getCurrentTRAN(schem, current, sparseConductance, param, time, timestep);
+				Circuit::Math::solveMatrix(sparseConductance, voltage, current);
+				return;
+			}
+			Circuit::Math::getConductanceTRAN(schem, conductance, param, time, timestep);
+			Circuit::Math::getCurrentTRAN(schem, current, conductance, param, time, timestep);
+			Circuit::Math::solveMatrix(conductance, voltage, current);
+		}
+		catch (const std::exception &e)
+		{
+			// a singular linearisation, the iteration sees it as a residual it cannot reduce
+			voltage.setConstant(std::numeric_limits<double>::quiet_NaN());
+		}
+	}
+
+	int operator()(const Eigen::VectorXd &vDiff, Eigen::VectorXd &fvec) const
+	{
+		getVdif(vDiff, fvec);
+		fvec -= vDiff;
 		return 0;
 	}
 	int getVdif(const Eigen::VectorXd &vDiff, Eigen::VectorXd &fvec) const
 	{
-
-		Eigen::VectorXd voltage(NUM_NODES);
-		Eigen::VectorXd current(NUM_NODES);
-		Eigen::MatrixXd conductance(NUM_NODES, NUM_NODES);
-
-		for (int i = 0; i < vDiff.size(); i++)
+		if (lowRankReady)
 		{
-			schem->nonLinearComps[i]->setConductance(param, timestep, vDiff(i));
+			linearise(vDiff);
+			if (lowRank.diodeVoltages(fvec))
+			{
+				return 0;
+			}
 		}
-		Circuit::Math::getConductanceTRAN(schem, conductance, param, time, timestep);
-		Circuit::Math::getCurrentTRAN(schem, current, conductance, param, time, timestep);
-		Circuit::Math::solveMatrix(conductance, voltage, current);
-
+		solve(vDiff);
 		for (int i = 0; i < vDiff.size(); i++)
 		{
 			double vPos = (schem->nonLinearComps[i]->getPosNode()->getId() != -1) ? voltage(schem->nonLinearComps[i]->getPosNode()->getId()) : 0;
@@ -98,30 +173,254 @@ struct ConductanceFunc : Functor<double>
 	}
 	void getVoltageVector(const Eigen::VectorXd &vDiff, Eigen::VectorXd &fvec)
 	{
-		Eigen::VectorXd current(NUM_NODES);
-		Eigen::MatrixXd conductance(NUM_NODES, NUM_NODES);
-
-		for (int i = 0; i < vDiff.size(); i++)
+		if (lowRankReady)
 		{
-			schem->nonLinearComps[i]->setConductance(param, timestep, vDiff(i));
+			linearise(vDiff);
+			if (lowRank.voltages(fvec))
+			{
+				return;
+			}
 		}
+		solve(vDiff);
+		fvec = voltage;
+	}
 
-		Circuit::Math::getConductanceTRAN(schem, conductance, param, time, timestep);
-		Circuit::Math::getCurrentTRAN(schem, current, conductance, param, time, timestep);
-		Circuit::Math::solveMatrix(conductance, fvec, current);
+	// Forward difference Jacobian with the step Eigen::NumericalDiff uses,
+	// written into jac without temporaries. fBase is left holding the residual
+	// at x.
+	int df(const Eigen::VectorXd &x, Eigen::MatrixXd &jac)
+	{
+		const double eps = std::sqrt(Eigen::NumTraits<double>::epsilon());
+		Circuit::Diode::ExactEvaluation exact;
+		(*this)(x, fBase);
+		xStep = x;
+		for (int j = 0; j < x.size(); j++)
+		{
+			double h = eps * std::abs(xStep[j]);
+			if (h == 0.)
+			{
+				h = eps;
+			}
+			xStep[j] += h;
+			(*this)(xStep, fStep);
+			xStep[j] = x[j];
+			jac.col(j) = (fStep - fBase) / h;
+		}
+		return 0;
 	}
 };
 
 class Circuit::Simulator
 {
+	friend class MonteCarlo;
+	friend class Scheduler;
+	friend class Analyses;
+
 private:
 	Schematic *schem;
+	ExpIntegrator expint;
 	double tranStopTime;
 	double tranSaveStart;
 	double tranStepTime;
 	std::stringstream spiceStream;
 	std::stringstream csvStream;
 
+	// The values of every output column over a run, kept in place of the
+	// printed points while the run is a Monte Carlo trial
+	struct Measurement
+	{
+		std::vector<double> last;
+		std::vector<double> lowest;
+		std::vector<double> highest;
+
+		void record(const std::vector<double> &values)
+		{
+			if (last.empty())
+			{
+				lowest = values;
+				highest = values;
+			}
+			for (size_t j = 0; j < values.size(); j++)
+			{
+				lowest[j] = std::min(lowest[j], values[j]);
+				highest[j] = std::max(highest[j], values[j]);
+			}
+			last = values;
+		}
+	};
+	Measurement *measuring = nullptr;
+	std::vector<double> point;
+	bool quiet = false; // no progress bar or run reports, see setQuiet
+	// operating points handed from a .op to a .tran analysis, see Analyses
+	OperatingPoint::Pipeline *publishing = nullptr;
+	OperatingPoint::Pipeline *seeding = nullptr;
+
+	// fast-forward through the unsaved region (.options ffwd)
+	bool fastForward = false;
+	double ffwdTol;
+	double ffwdMaxStep;
+	int ffwdPoints;
+	double ffwdSwitch; // see saveSwitchTime
+	double ffwdPrevStep;
+	std::vector<Inductor *> ffwdInductors;
+	Eigen::VectorXd ffwdState; // node voltages, then inductor currents
+	Eigen::VectorXd ffwdPrev;
+	Eigen::VectorXd ffwdSlope;
+
+	void resetStepControl(unsigned int NUM_NODES)
+	{
+		fastForward = schem->getOption("ffwd", 0) != 0 && tranSaveStart > 0;
+		ffwdTol = schem->getOption("ffwdtol", 1e-4);
+		ffwdMaxStep = schem->getOption("ffwdmaxstep", 100 * tranStepTime);
+		ffwdPoints = 0;
+		// the time the fixed step reaches after as many steps as fit before
+		// tranSaveStart, added up the way a run without ffwd adds them up
+		ffwdSwitch = 0;
+		for (long k = std::floor(tranSaveStart / tranStepTime); fastForward && k > 0; k--)
+		{
+			ffwdSwitch += tranStepTime;
+		}
+		ffwdInductors.clear();
+		for (std::pair<std::string, Component *> comp : schem->comps)
+		{
+			if (Inductor *l = dynamic_cast<Inductor *>(comp.second))
+			{
+				ffwdInductors.push_back(l);
+			}
+		}
+		ffwdState.resize(NUM_NODES + ffwdInductors.size());
+		ffwdPrev.resize(ffwdState.size());
+		ffwdSlope.resize(ffwdState.size());
+	}
+
+	// last grid point at or before tranSaveStart, where the fast-forward
+	// hands over to the fixed step
+	double saveSwitchTime() const
+	{
+		return ffwdSwitch;
+	}
+
+	// Returns the step to take after the solution at time t. Before the save
+	// window the step is grown or shrunk with a backward Euler truncation error
+	// estimate (second divided difference of the state: node voltages and
+	// inductor currents); the last coarse step lands on the fixed grid so saved
+	// points keep tranStepTime.
+	double nextStep(ParamTable *param, double t, double step, const Eigen::VectorXd &voltage)
+	{
+		if (!fastForward)
+		{
+			return tranStepTime;
+		}
+		const double tSwitch = saveSwitchTime();
+		if (t >= tSwitch - 0.5 * tranStepTime)
+		{
+			return tranStepTime;
+		}
+
+		const int NUM_NODES = voltage.size();
+		ffwdState.head(NUM_NODES) = voltage;
+		for (size_t k = 0; k < ffwdInductors.size(); k++)
+		{
+			ffwdState[NUM_NODES + k] = ffwdInductors[k]->getCurrent(param, t, step);
+		}
+		double next = tranStepTime;
+		if (ffwdPoints >= 1)
+		{
+			double ratio = 0;
+			const double vntol = schem->getOption("vntol", 1e-6);
+			const double abstol = schem->getOption("abstol", 1e-12);
+			for (int n = 0; n < ffwdState.size(); n++)
+			{
+				double slope = (ffwdState[n] - ffwdPrev[n]) / step;
+				if (ffwdPoints >= 2)
+				{
+					double lte = step * step * std::abs(slope - ffwdSlope[n]) / (step + ffwdPrevStep);
+					ratio = std::max(ratio, lte / (ffwdTol * std::abs(ffwdState[n]) + (n < NUM_NODES ? vntol : abstol)));
+				}
+				ffwdSlope[n] = slope;
+			}
+			if (ffwdPoints >= 2)
+			{
+				double factor = ratio > 0 ? 0.9 / std::sqrt(ratio) : 2.0;
+				next = step * std::min(2.0, std::max(0.5, factor));
+			}
+		}
+		ffwdPrev = ffwdState;
+		ffwdPrevStep = step;
+		ffwdPoints++;
+
+		next = std::min(ffwdMaxStep, std::max(tranStepTime, next));
+		if (t + next > tSwitch - 0.5 * tranStepTime)
+		{
+			next = tSwitch - t;
+		}
+		return next;
+	}
+
+	// Time after a step from t. The last coarse step lands exactly on
+	// saveSwitchTime, and from there the steps add up as in a run without
+	// ffwd, so the saved points are the same times.
+	double advanceTime(double t, double step)
+	{
+		const double tSwitch = saveSwitchTime();
+		if (fastForward && t < tSwitch - 0.5 * tranStepTime && t + step >= tSwitch - 0.5 * tranStepTime)
+		{
+			return tSwitch;
+		}
+		return t + step;
+	}
+
+	// The inductor history term is G v - i with G = timestep / L, so it only
+	// holds for the step it was built for: when the step changes it is
+	// rebuilt from the inductor current at the end of the last step.
+	void changeStep(ParamTable *param, double t, double from, double to)
+	{
+		if (from == to)
+		{
+			return;
+		}
+		for (Inductor *l : ffwdInductors)
+		{
+			l->setCurrent(param, to, l->getCurrent(param, t, from));
+		}
+	}
+
+	void readNodeVoltages(Eigen::VectorXd &voltage) const
+	{
+		for (std::pair<std::string, Node *> node : schem->nodes)
+		{
+			if (node.second->getId() != -1)
+			{
+				voltage[node.second->getId()] = node.second->voltage;
+			}
+		}
+	}
+
+	// reports how the operating point converged for nonlinear circuits
+	// solves the operating point of run i of the sweep, or takes the one a
+	// .op analysis running alongside found for it
+	void solveOperatingPoint(OperatingPoint &op, size_t i)
+	{
+		OperatingPoint::Solution seed;
+		OperatingPoint::Strategy strategy = seeding && seeding->take(i, seed) ? op.adopt(seed) : op.solve();
+		if (publishing)
+		{
+			publishing->publish(i, op);
+		}
+		if (quiet)
+		{
+			return;
+		}
+		if (strategy == OperatingPoint::Failed)
+		{
+			std::cerr << "operating point did not converge, starting from zero" << std::endl;
+		}
+		else if (schem->nonLinear)
+		{
+			std::cerr << "operating point converged by " << OperatingPoint::describe(strategy) << " in " << op.getIterations() << " iterations" << std::endl;
+		}
+	}
+
 	void spicePrintTitle()
 	{
 		spiceStream << "Time";
@@ -129,6 +428,10 @@ private:
 		{
 			spiceStream << "\tV(" << node_pair.first << ")";
 		}
+		for (auto eliminated_pair : schem->eliminated)
+		{
+			spiceStream << "\tV(" << eliminated_pair.first << ")";
+		}
 		for (auto comp_pair : schem->comps)
 		{
 			spiceStream << "\tI(" << comp_pair.first << ")";
@@ -142,6 +445,10 @@ private:
 		{
 			csvStream << ",V(" << node_pair.first << ")";
 		}
+		for (auto eliminated_pair : schem->eliminated)
+		{
+			csvStream << ",V(" << eliminated_pair.first << ")";
+		}
 		for (auto comp_pair : schem->comps)
 		{
 			csvStream << ",I(" << comp_pair.first << ")";
@@ -151,22 +458,22 @@ private:
 
 	void printStep(int n)
 	{
-		ParamTable *param = schem->tables[n];
-		if (param->lookup.size() == 0)
+		ParamTable param = schem->sweep[n];
+		if (param.lookup.size() == 0)
 		{
 			return;
 		}
-		for (auto x : param->lookup)
+		for (auto x : param.lookup)
 		{
 			spiceStream << "Step Information:";
 			csvStream << "Step Information:";
-			for (std::pair<std::string, double> var : param->lookup)
+			for (std::pair<std::string, double> var : param.lookup)
 			{
 				csvStream << " " << var.first << "=" << var.second;
 				spiceStream << " " << var.first << "=" << var.second;
 			}
-			csvStream << " Run: " << n + 1 << "/" << schem->tables.size() << std::endl;
-			spiceStream << " Run: " << n + 1 << "/" << schem->tables.size() << std::endl;
+			csvStream << " Run: " << schem->sweep.number(n) + 1 << "/" << schem->sweep.total() << std::endl;
+			spiceStream << " Run: " << schem->sweep.number(n) + 1 << "/" << schem->sweep.total() << std::endl;
 		}
 	}
 	void spicePrint(ParamTable *param, double time, double timestep)
@@ -176,6 +483,11 @@ private:
 		{
 			spiceStream << "\t" << node_pair.second->voltage;
 		}
+		schem->reconstructVoltages();
+		for (auto eliminated_pair : schem->eliminated)
+		{
+			spiceStream << "\t" << eliminated_pair.second.voltage;
+		}
 		for (auto comp_pair : schem->comps)
 		{
 			spiceStream << "\t" << comp_pair.second->getCurrent(param, time, timestep);
@@ -189,12 +501,35 @@ private:
 		{
 			csvStream << "," << node_pair.second->voltage;
 		}
+		schem->reconstructVoltages();
+		for (auto eliminated_pair : schem->eliminated)
+		{
+			csvStream << "," << eliminated_pair.second.voltage;
+		}
 		for (auto comp_pair : schem->comps)
 		{
 			csvStream << "," << comp_pair.second->getCurrent(param, time, timestep);
 		}
 		csvStream << "\n";
 	}
+	// the values of the output columns in the order of the title
+	void pointValues(ParamTable *param, double time, double timestep, std::vector<double> &values)
+	{
+		values.clear();
+		for (auto node_pair : schem->nodes)
+		{
+			values.push_back(node_pair.second->voltage);
+		}
+		schem->reconstructVoltages();
+		for (auto eliminated_pair : schem->eliminated)
+		{
+			values.push_back(eliminated_pair.second.voltage);
+		}
+		for (auto comp_pair : schem->comps)
+		{
+			values.push_back(comp_pair.second->getCurrent(param, time, timestep));
+		}
+	}
 
 public:
 	enum SimulationType
@@ -213,6 +548,378 @@ public:
 		SPACE // actually tab separated
 	};
 
+private:
+	void savePoint(ParamTable *param, double time, double timestep, OutputFormat format)
+	{
+		if (time >= tranSaveStart)
+		{
+			if (measuring)
+			{
+				pointValues(param, time, timestep, point);
+				measuring->record(point);
+			}
+			else if (format == SPACE)
+			{
+				spicePrint(param, time, timestep);
+			}
+			else if (format == CSV)
+			{
+				csvPrint(param, time, timestep);
+			}
+		}
+	}
+
+	// .step variables that set a matrix entry, as opposed to those that only
+	// reach the right hand side through source values
+	std::set<std::string> matrixVariables() const
+	{
+		std::set<std::string> names;
+		for (std::pair<std::string, Component *> comp : schem->comps)
+		{
+			if (comp.second->isVariableDefined() && !comp.second->isSource())
+			{
+				names.insert(comp.second->getVariableName());
+			}
+		}
+		return names;
+	}
+
+	// Whether the runs of a transient .step sweep can advance together, see
+	// runBatched and runLockstep. Nonlinear circuits, reduced models (whose
+	// internal state is not swapped per run) and the variable step and
+	// exponential integrators keep running one run at a time.
+	bool sweepsTogether() const
+	{
+		return type == TRAN && schem->sweep.size() > 1 && !schem->nonLinear && schem->macromodels.empty() &&
+			   schem->getOption("batchsweep", 1) != 0 && schem->getOption("expint", 0) == 0 &&
+			   !(schem->getOption("ffwd", 0) != 0 && tranSaveStart > 0);
+	}
+
+	// true if no swept variable sets a matrix entry, so every run of the
+	// sweep has the same matrix
+	bool sweepsSourcesOnly() const
+	{
+		std::set<std::string> matrix = matrixVariables();
+		for (std::pair<std::string, double> var : schem->sweep[0].lookup)
+		{
+			if (matrix.count(var.first))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// State of the runs of a sweep that advance together, one column per run:
+	// the step values, the node voltages and the companion model history. A
+	// run's column is loaded into the schematic while its right hand side is
+	// assembled and while its point is printed.
+	struct RunStates
+	{
+		Schematic *schem;
+		std::vector<LC *> companions;
+		std::vector<ParamTable> params;
+		Eigen::MatrixXd voltages;
+		Eigen::MatrixXd history;
+
+		RunStates(Schematic *schem, int runs) : schem(schem)
+		{
+			for (std::pair<std::string, Component *> comp : schem->comps)
+			{
+				if (LC *lc = dynamic_cast<LC *>(comp.second))
+				{
+					companions.push_back(lc);
+				}
+			}
+			params.resize(runs);
+			voltages.resize(schem->nodes.size() - 1, runs);
+			history.resize(companions.size(), runs);
+		}
+
+		void load(int k) const
+		{
+			for (std::pair<std::string, Node *> node : schem->nodes)
+			{
+				if (node.second->getId() != -1)
+				{
+					node.second->voltage = voltages(node.second->getId(), k);
+				}
+			}
+			for (size_t j = 0; j < companions.size(); j++)
+			{
+				companions[j]->setHistory(history(j, k));
+			}
+		}
+
+		void storeHistory(int k)
+		{
+			for (size_t j = 0; j < companions.size(); j++)
+			{
+				history(j, k) = companions[j]->getHistory();
+			}
+		}
+	};
+
+	std::stringstream &outputStream(OutputFormat format)
+	{
+		return format == CSV ? csvStream : spiceStream;
+	}
+
+	// Solves the operating point of run i of the sweep into column k of
+	// states and prints the step header and the t = 0 point into output.
+	void startRun(size_t i, RunStates &states, int k, std::stringstream &output, OutputFormat format)
+	{
+		states.params[k] = schem->sweep[i];
+		ParamTable *param = &states.params[k];
+		outputStream(format).swap(output);
+		printStep(i);
+		for_each(schem->nodes.begin(), schem->nodes.end(), [&](const auto node_pair) {
+			if (node_pair.second->getId() != -1)
+			{
+				node_pair.second->voltage = 0.0;
+			}
+		});
+		OperatingPoint op(schem, param);
+		solveOperatingPoint(op, i);
+		op.apply(tranStepTime);
+		for (std::pair<std::string, Node *> node : schem->nodes)
+		{
+			if (node.second->getId() != -1)
+			{
+				states.voltages(node.second->getId(), k) = node.second->voltage;
+			}
+		}
+		states.storeHistory(k);
+		savePoint(param, 0, tranStepTime, format);
+		outputStream(format).swap(output);
+	}
+
+	// prints run k of states at time t into output
+	void savePoint(RunStates &states, int k, std::stringstream &output, double t, OutputFormat format)
+	{
+		states.load(k);
+		outputStream(format).swap(output);
+		savePoint(&states.params[k], t, tranStepTime, format);
+		outputStream(format).swap(output);
+	}
+
+	// Transient of a .step sweep whose variables only reach the right hand
+	// side. Every run has the same matrix, so the runs advance in lockstep: the
+	// matrix is assembled and factorised once per timestep for all of them and
+	// the right hand sides are solved as the columns of one N x K system.
+	void runBatched(std::ostream &dst, OutputFormat format)
+	{
+		const int NUM_NODES = schem->nodes.size() - 1;
+		const int RUNS = schem->sweep.size();
+		const bool sparse = Math::assemblesSparse(NUM_NODES);
+		Eigen::MatrixXd conductance(sparse ? 0 : NUM_NODES, sparse ? 0 : NUM_NODES);
+		Eigen::SparseMatrix<double> sparseConductance;
+		Eigen::VectorXd current(NUM_NODES);
+		Eigen::MatrixXd currents(NUM_NODES, RUNS);
+		Eigen::MatrixXd solved(NUM_NODES, RUNS);
+		RunStates states(schem, RUNS);
+		std::vector<std::stringstream> runOutput(RUNS);
+		dst << outputStream(format).str();
+		outputStream(format).str("");
+
+		// every run starts from its own DC operating point
+		for (int k = 0; k < RUNS; k++)
+		{
+			startRun(k, states, k, runOutput[k], format);
+		}
+
+		const double step = tranStepTime;
+		for (double t = step; t <= tranStopTime; t += step)
+		{
+			if (!quiet)
+			{
+				Math::progressBar(t / tranStopTime, RUNS - 1, RUNS);
+			}
+			if (sparse)
+			{
+				Math::getConductanceTRAN(schem, sparseConductance, &states.params[0], t, step);
+				Math::stampVoltageSourceRows(schem, sparseConductance);
+			}
+			else
+			{
+				Math::getConductanceTRAN(schem, conductance, &states.params[0], t, step);
+				Math::stampVoltageSourceRows(schem, conductance);
+			}
+			for (int k = 0; k < RUNS; k++)
+			{
+				states.load(k);
+				Math::getCurrentTRAN(schem, current, &states.params[k], t, step);
+				currents.col(k) = current;
+				states.storeHistory(k);
+			}
+
+			try
+			{
+				if (sparse)
+				{
+					Circuit::Math::solveMatrix(sparseConductance, solved, currents);
+				}
+				else
+				{
+					Circuit::Math::solveMatrix(conductance, solved, currents);
+				}
+			}
+			catch (const std::exception &e)
+			{
+				std::cerr << "error solving skipping timestep" << std::endl;
+				continue;
+			}
+			states.voltages.swap(solved);
+
+			for (int k = 0; k < RUNS; k++)
+			{
+				savePoint(states, k, runOutput[k], t, format);
+			}
+		}
+		if (!quiet)
+		{
+			std::cerr << std::endl
+					  << RUNS << " .step runs solved together, the swept variables only change sources" << std::endl;
+		}
+		for (std::stringstream &run : runOutput)
+		{
+			dst << run.str();
+		}
+	}
+
+	// Transient of a .step sweep that changes component values. The runs
+	// share the sparsity pattern, so they advance LaneLU::WIDTH at a time in
+	// the lanes of one LaneLU: the symbolic analysis is done once for the
+	// sweep, each group of runs is factorised once in a single vectorised
+	// pass, and every timestep is one vectorised pair of triangular solves.
+	// Runs whose lane fails (a pattern that differs or a pivot that
+	// collapses) are simulated on their own afterwards.
+	void runLockstep(std::ostream &dst, OutputFormat format)
+	{
+		const int NUM_NODES = schem->nodes.size() - 1;
+		const int RUNS = schem->sweep.size();
+		const int WIDTH = LaneLU::WIDTH;
+		const double step = tranStepTime;
+		const bool direct = Math::assemblesSparse(NUM_NODES);
+		Eigen::MatrixXd conductance(direct ? 0 : NUM_NODES, direct ? 0 : NUM_NODES);
+		Eigen::SparseMatrix<double> sparse;
+		// the system of a run, assembled straight into sparse when it is large
+		auto assemble = [&](ParamTable *param) {
+			if (direct)
+			{
+				Math::getConductanceTRAN(schem, sparse, param, step, step);
+				Math::stampVoltageSourceRows(schem, sparse);
+				return;
+			}
+			Math::getConductanceTRAN(schem, conductance, param, step, step);
+			Math::stampVoltageSourceRows(schem, conductance);
+			sparse = conductance.sparseView();
+		};
+		Eigen::VectorXd current(NUM_NODES);
+		std::vector<LaneLU::Lane, Eigen::aligned_allocator<LaneLU::Lane>> x(NUM_NODES);
+		RunStates states(schem, WIDTH);
+		std::vector<std::stringstream> runOutput(RUNS);
+		std::vector<size_t> alone;
+		dst << outputStream(format).str();
+		outputStream(format).str("");
+
+		// the matrix does not depend on time, only on the step and the values
+		LaneLU lu;
+		ParamTable firstRun = schem->sweep[0];
+		assemble(&firstRun);
+		if (!lu.analyze(sparse, schem->getOption("lockstepmaxops", 1e7)))
+		{
+			for (size_t i = 0; i < schem->sweep.size(); i++)
+			{
+				runTable(i, dst, format);
+			}
+			return;
+		}
+
+		for (int first = 0; first < RUNS; first += WIDTH)
+		{
+			const int lanes = std::min(WIDTH, RUNS - first);
+			std::vector<bool> active(WIDTH, false);
+			for (int k = 0; k < lanes; k++)
+			{
+				startRun(first + k, states, k, runOutput[first + k], format);
+				assemble(&states.params[k]);
+				active[k] = lu.setLane(k, sparse);
+			}
+			for (int k = lanes; k < WIDTH; k++)
+			{
+				lu.copyLane(0, k);
+			}
+			lu.factorize();
+			for (int k = 0; k < lanes; k++)
+			{
+				active[k] = active[k] && !lu.failedLane(k);
+				if (!active[k])
+				{
+					alone.push_back(first + k);
+				}
+			}
+
+			for (double t = step; t <= tranStopTime; t += step)
+			{
+				if (!quiet)
+				{
+					Math::progressBar(t / tranStopTime, first + lanes - 1, RUNS);
+				}
+				for (int k = 0; k < WIDTH; k++)
+				{
+					if (!active[k])
+					{
+						for (int i = 0; i < NUM_NODES; i++)
+						{
+							x[i][k] = 0;
+						}
+						continue;
+					}
+					states.load(k);
+					Math::getCurrentTRAN(schem, current, &states.params[k], t, step);
+					for (int i = 0; i < NUM_NODES; i++)
+					{
+						x[i][k] = current[i];
+					}
+					states.storeHistory(k);
+				}
+				lu.solve(x);
+				for (int k = 0; k < lanes; k++)
+				{
+					if (active[k])
+					{
+						for (int i = 0; i < NUM_NODES; i++)
+						{
+							states.voltages(i, k) = x[i][k];
+						}
+						savePoint(states, k, runOutput[first + k], t, format);
+					}
+				}
+			}
+		}
+		if (!quiet)
+		{
+			std::cerr << std::endl
+					  << RUNS << " .step runs solved " << WIDTH << " at a time in SIMD lanes";
+			if (!alone.empty())
+			{
+				std::cerr << ", " << alone.size() << " of them on their own";
+			}
+			std::cerr << std::endl;
+		}
+		for (size_t i : alone)
+		{
+			runOutput[i].str("");
+			runTable(i, runOutput[i], format);
+		}
+		for (std::stringstream &run : runOutput)
+		{
+			dst << run.str();
+		}
+	}
+
+public:
 	using enumPair = std::pair<SimulationType, std::string>;
 
 	std::map<SimulationType, std::string> simulationTypeMap = {
@@ -222,7 +929,7 @@ public:
 		enumPair(SMALL_SIGNAL, "SMALL_SIGNAL"),
 	};
 
-	Simulator(Schematic *schem, SimulationType type) : schem(schem), type(type) {}
+	Simulator(Schematic *schem, SimulationType type) : schem(schem), expint(schem), type(type) {}
 	Simulator(Schematic *schem, SimulationType type, double tranStopTime, double tranSaveStart = 0, double tranStepTime = 0) : Simulator(schem, type)
 	{
 		if (tranStepTime == 0)
@@ -234,82 +941,207 @@ public:
 		this->tranStepTime = tranStepTime;
 	}
 
-	void run(std::ostream &dst, OutputFormat format)
+	double getTranStopTime() const
 	{
-		const unsigned int NUM_NODES = schem->nodes.size() - 1;
-		const unsigned int NUM_V_GUESS = schem->nonLinearComps.size();
-
-		Eigen::VectorXd voltage(NUM_NODES);
-		Eigen::VectorXd vGuess(NUM_V_GUESS);
-		Eigen::VectorXd current(NUM_NODES);
-		Eigen::MatrixXd conductance(NUM_NODES, NUM_NODES);
+		return tranStopTime;
+	}
+	double getTranStepTime() const
+	{
+		return tranStepTime;
+	}
+	// no progress bar or reports on stderr, for shard processes
+	void setQuiet(bool on)
+	{
+		quiet = on;
+	}
 
+	void run(std::ostream &dst, OutputFormat format)
+	{
+		// a shard after the first continues the output of the one before it
+		const bool title = schem->sweep.number(0) == 0;
 		if (format == SPACE)
 		{
 			spiceStream.str("");
-			spicePrintTitle();
+			if (title)
+			{
+				spicePrintTitle();
+			}
 		}
 		else if (format == CSV)
 		{
 			csvStream.str("");
-			csvPrintTitle();
+			if (title)
+			{
+				csvPrintTitle();
+			}
+		}
+		if (schem->sweep.trials() > 0)
+		{
+			runMonteCarlo(dst, format);
+			return;
+		}
+		if (sweepsTogether() && sweepsSourcesOnly())
+		{
+			runBatched(dst, format);
+			return;
+		}
+		if (sweepsTogether())
+		{
+			runLockstep(dst, format);
+			return;
+		}
+		if (sweepsInParallel())
+		{
+			runParallel(dst, format);
+			return;
 		}
-		ParamTable *param;
-		for (size_t i = 0; i < schem->tables.size(); i++)
+		for (size_t i = 0; i < schem->sweep.size(); i++)
 		{
-			param = schem->tables[i];
-			printStep(i);
+			runTable(i, dst, format);
+		}
+	}
+
+private:
+	// the trials of a .mc analysis, see MonteCarlo
+	void runMonteCarlo(std::ostream &dst, OutputFormat format);
+	// the runs of a sweep spread over threads, see Scheduler
+	void runParallel(std::ostream &dst, OutputFormat format);
+
+	// runs that do not advance together still go in parallel when there
+	// are threads for them
+	bool sweepsInParallel() const
+	{
+		return schem->sweep.size() > 1 && schem->getOption("threads", std::thread::hardware_concurrency()) > 1;
+	}
 
+	// runs the simulation for run i of the sweep on its own
+	void runTable(size_t i, std::ostream &dst, OutputFormat format)
+	{
+		const unsigned int NUM_NODES = schem->nodes.size() - 1;
+		const unsigned int NUM_V_GUESS = schem->nonLinearComps.size();
+
+		Eigen::VectorXd voltage(NUM_NODES);
+		Eigen::VectorXd vGuess(NUM_V_GUESS);
+		Eigen::VectorXd current(NUM_NODES);
+		const bool sparse = Math::assemblesSparse(NUM_NODES);
+		Eigen::MatrixXd conductance(sparse ? 0 : NUM_NODES, sparse ? 0 : NUM_NODES);
+		Eigen::SparseMatrix<double> sparseConductance;
+
+		ParamTable table = schem->sweep[i];
+		ParamTable *param = &table;
+		printStep(i);
+		Diode::resetCounters();
+
+		for_each(schem->nodes.begin(), schem->nodes.end(), [&](const auto node_pair) {
+			if (node_pair.second->getId() != -1)
+			{
+				node_pair.second->voltage = 0.0;
+			}
+		});
+		if (type == OP)
+		{
+			OperatingPoint op(schem, param);
+			solveOperatingPoint(op, i);
+			op.apply(-1);
+			if (measuring)
+			{
+				pointValues(param, 0, -1, point);
+				measuring->record(point);
+				return;
+			}
+
+			dst << "\t-----Operating Point-----\t\n";
+			if (param->lookup.size() > 0)
+			{
+				dst << "Step Information: ";
+				for (std::pair<std::string, double> var : param->lookup)
+				{
+					dst << " " << var.first << "=" << var.second;
+				}
+				dst << " Run: " << schem->sweep.number(i) + 1 << "/" << schem->sweep.total() << std::endl;
+			}
+			dst << std::endl;
 			for_each(schem->nodes.begin(), schem->nodes.end(), [&](const auto node_pair) {
 				if (node_pair.second->getId() != -1)
 				{
-					node_pair.second->voltage = 0.0;
+					dst << "V(" << node_pair.first << ")\t\t" << node_pair.second->voltage << "\t\tnode_voltage\n";
 				}
 			});
-			if (type == OP)
+			schem->reconstructVoltages();
+			for (auto eliminated_pair : schem->eliminated)
 			{
-				Circuit::Math::getConductanceOP(schem, conductance, param);
-				Circuit::Math::getCurrentOP(schem, current, conductance, param);
-				Circuit::Math::solveMatrix(conductance, voltage, current);
+				dst << "V(" << eliminated_pair.first << ")\t\t" << eliminated_pair.second.voltage << "\t\tnode_voltage\n";
+			}
 
-				dst << "\t-----Operating Point-----\t\n";
-				if (param->lookup.size() > 0)
+			for_each(schem->comps.begin(), schem->comps.end(), [&](const auto comp_pair) {
+				dst << "I(" << comp_pair.first << ")\t\t" << comp_pair.second->getCurrent(param, 0, -1) << "\t\tdevice_current\n";
+			});
+		}
+		else if (type == TRAN)
+		{
+			bool exact = false;
+			if (!schem->nonLinear && schem->getOption("expint", 0) != 0)
+			{
+				exact = expint.build(param);
+				if (!exact)
 				{
-					dst << "Step Information: ";
-					for (std::pair<std::string, double> var : param->lookup)
+					std::cerr << "exponential integrator not applicable, using companion models" << std::endl;
+				}
+			}
+
+			// every transient starts from the DC operating point
+			OperatingPoint op(schem, param);
+			solveOperatingPoint(op, i);
+			op.apply(tranStepTime);
+
+			if (exact)
+			{
+				expint.seed(param, tranStepTime);
+				double step = tranStepTime;
+				resetStepControl(NUM_NODES);
+				const double tSwitch = saveSwitchTime();
+				for (double t = 0; t <= tranStopTime; t = advanceTime(t, step))
+				{
+					if (!quiet)
 					{
-						dst << " " << var.first << "=" << var.second;
+						Math::progressBar(t / tranStopTime, i, schem->sweep.size());
 					}
-					dst << " Run: " << i + 1 << "/" << schem->tables.size() << std::endl;
-				}
-				dst << std::endl;
-				for_each(schem->nodes.begin(), schem->nodes.end(), [&](const auto node_pair) {
-					if (node_pair.second->getId() != -1)
+					if (t > 0)
 					{
-						node_pair.second->voltage = voltage[node_pair.second->getId()];
-						dst << "V(" << node_pair.first << ")\t\t" << node_pair.second->voltage << "\t\tnode_voltage\n";
+						expint.advance(step);
 					}
-				});
-
-				for_each(schem->comps.begin(), schem->comps.end(), [&](const auto comp_pair) {
-					dst << "I(" << comp_pair.first << ")\t\t" << comp_pair.second->getCurrent(param, 0, -1) << "\t\tdevice_current\n";
-				});
+					expint.apply(param, step);
+					savePoint(param, t, step, format);
+					// exact steps need no error control, so jump straight to the save window
+					step = (fastForward && t < tSwitch - 0.5 * tranStepTime) ? tSwitch - t : tranStepTime;
+				}
 			}
-			else if (type == TRAN)
+			else if (!schem->nonLinear)
 			{
-				if (!schem->nonLinear)
+				double step = tranStepTime;
+				resetStepControl(NUM_NODES);
+				for (double t = 0; t <= tranStopTime; t = advanceTime(t, step))
 				{
-					Eigen::SparseMatrix<double> sparse;
-
-					for (double t = 0; t <= tranStopTime; t += tranStepTime)
+					if (!quiet)
+					{
+						Math::progressBar(t / tranStopTime, i, schem->sweep.size());
+					}
+					if (t > 0)
 					{
-						Math::progressBar(t / tranStopTime, i, schem->tables.size());
-						Math::getConductanceTRAN(schem, conductance, param, t, tranStepTime);
-						Math::getCurrentTRAN(schem, current, conductance, param, t, tranStepTime);
-
 						try
 						{
-							Circuit::Math::solveMatrix(conductance, voltage, current);
+							if (sparse)
+							{
+								Math::getConductanceTRAN(schem, sparseConductance, param, t, step);
+								Math::getCurrentTRAN(schem, current, sparseConductance, param, t, step);
+								Circuit::Math::solveMatrix(sparseConductance, voltage, current);
+							}
+							else
+							{
+								Math::getConductanceTRAN(schem, conductance, param, t, step);
+								Math::getCurrentTRAN(schem, current, conductance, param, t, step);
+								Circuit::Math::solveMatrix(conductance, voltage, current);
+							}
 						}
 						catch (const std::exception &e)
 						{
@@ -323,102 +1155,115 @@ public:
 								node_pair.second->voltage = voltage[node_pair.second->getId()];
 							}
 						});
-						if (t >= tranSaveStart)
-						{
-							if (format == SPACE)
-							{
-								spicePrint(param, t, tranStepTime);
-							}
-							else if (format == CSV)
-							{
-								csvPrint(param, t, tranStepTime);
-							}
-						}
 					}
+					else
+					{
+						readNodeVoltages(voltage);
+					}
+					savePoint(param, t, step, format);
+					const double last = step;
+					step = nextStep(param, t, step, voltage);
+					changeStep(param, t, last, step);
 				}
-				else
+			}
+			else
+			{
+				// one functor, solver and set of workspaces for the whole run
+				ConductanceFunc functor(schem, param, 0, tranStepTime, NUM_NODES);
+				Eigen::LevenbergMarquardt<ConductanceFunc, double> lm(functor);
+				lm.parameters.maxfev = 1000;
+				lm.parameters.xtol = 1.0e-10;
+				Circuit::Newton newton(schem, schem->getOption("itl4", 10));
+				const Schematic::IterationType itType = schem->getOption("levenberg", 0) != 0 ? Schematic::IterationType::Levenberg : schem->itType;
+				int newtonIterations = 0;
+				int newtonSteps = 0;
+				int fallbacks = 0;
+
+				// Newton starts each step from the diode voltages of the last one
+				vGuess = op.getDiodeVoltages();
+				double step = tranStepTime;
+				resetStepControl(NUM_NODES);
+				for (double t = 0; t <= tranStopTime; t = advanceTime(t, step))
 				{
-					for (double t = 0; t <= tranStopTime; t += tranStepTime)
+					//Math::progressBar(t / tranStopTime, i, schem->sweep.size());
+					if (t == 0)
 					{
-						//Math::progressBar(t / tranStopTime, i, schem->tables.size());
-						Math::init_vector(vGuess);
-						ConductanceFunc functor(schem, param, t, tranStepTime, NUM_NODES);
-						Eigen::NumericalDiff<ConductanceFunc> numDiff(functor);
+						readNodeVoltages(voltage);
+						savePoint(param, t, step, format);
+						const double last = step;
+						step = nextStep(param, t, step, voltage);
+						changeStep(param, t, last, step);
+						continue;
+					}
+					functor.setTime(t, step);
 
-						if (schem->itType == Schematic::IterationType::Levenberg)
+					if (itType == Schematic::IterationType::Newton)
+					{
+						if (newton.solve(functor, vGuess))
 						{
-							Eigen::LevenbergMarquardt<Eigen::NumericalDiff<ConductanceFunc>, double> lm(numDiff);
-							lm.parameters.maxfev = 1000;
-							lm.parameters.xtol = 1.0e-10;
-							lm.minimize(vGuess);
-						}
-						else if (schem->itType == Schematic::IterationType::Newton)
-						{
-							for (size_t i = 0; i < 1000; i++)
-							{
-								Eigen::MatrixXd jaq(NUM_V_GUESS, NUM_V_GUESS);
-								numDiff.df(vGuess, jaq);
-								Eigen::VectorXd vErrVec(NUM_V_GUESS);
-								functor(vGuess, vErrVec);
-								Eigen::MatrixXd inverseJaq = jaq.transpose().inverse();
-								for (size_t x = 0; x < NUM_V_GUESS; x++)
-								{
-									for (size_t y = 0; y < NUM_V_GUESS; y++)
-									{
-										if (std::isnan(inverseJaq(x, y)))
-										{
-											inverseJaq(x, y) = 1e-200;
-										}
-										if (!std::isfinite(inverseJaq(x, y)))
-										{
-											inverseJaq(x, y) = 1e200;
-										}
-									}
-								}
-								std::cerr<<t<<","<<i<<","<<vGuess[0]<<","<<vGuess[1]<<","<<vErrVec.norm()<<std::endl;
-								vGuess = vGuess - 0.005 * (inverseJaq * vErrVec);
-							}
+							newtonIterations += newton.getIterations();
+							newtonSteps++;
 						}
 						else
 						{
-							std::cerr << "unknown iteration type" << std::endl;
-							std::terminate();
+							// retry the step with the minimiser, which only
+							// copes reliably when started from zero
+							fallbacks++;
+							Math::init_vector(vGuess);
+							lm.minimize(vGuess);
 						}
+					}
+					else if (itType == Schematic::IterationType::Levenberg)
+					{
+						Math::init_vector(vGuess);
+						lm.minimize(vGuess);
+					}
+					else
+					{
+						std::cerr << "unknown iteration type" << std::endl;
+						std::terminate();
+					}
 
-						Eigen::VectorXd vErrVec(NUM_V_GUESS);
-						functor.getVoltageVector(vGuess, voltage);
-						for_each(schem->nodes.begin(), schem->nodes.end(), [&](const auto node_pair) {
-							if (node_pair.second->getId() != -1)
-							{
-								node_pair.second->voltage = voltage[node_pair.second->getId()];
-							}
-						});
-						if (t >= tranSaveStart)
+					functor.getVoltageVector(vGuess, voltage);
+					for_each(schem->nodes.begin(), schem->nodes.end(), [&](const auto node_pair) {
+						if (node_pair.second->getId() != -1)
 						{
-							if (format == SPACE)
-							{
-								spicePrint(param, t, tranStepTime);
-							}
-							else if (format == CSV)
-							{
-								csvPrint(param, t, tranStepTime);
-							}
+							node_pair.second->voltage = voltage[node_pair.second->getId()];
 						}
-					}
+					});
+					savePoint(param, t, step, format);
+					const double last = step;
+					step = nextStep(param, t, step, voltage);
+					changeStep(param, t, last, step);
+				}
+				if (!quiet && itType == Schematic::IterationType::Newton)
+				{
+					std::cerr << "Newton: " << newtonSteps << " steps, " << (newtonSteps ? double(newtonIterations) / newtonSteps : 0) << " iterations per step, " << newton.getJacobians() << " Jacobians, " << fallbacks << " fallbacks to Levenberg-Marquardt" << std::endl;
+				}
+				if (!quiet && functor.useLowRank)
+				{
+					std::cerr << "low rank diode updates: " << functor.lowRank.getFactorisations() << " factorisations" << std::endl;
+				}
+				if (!quiet && !functor.useBank && Diode::evaluations > 0)
+				{
+					std::cerr << "bypassed " << Diode::bypassed << " of " << Diode::evaluations << " diode evaluations";
 				}
-				std::cerr << std::endl;
-			}
-			if (format == SPACE && type != OP)
-			{
-				dst << spiceStream.str();
-				spiceStream.str("");
 			}
-			else if (format == CSV && type != OP)
+			if (!quiet)
 			{
-				dst << csvStream.str();
-				csvStream.str("");
+				std::cerr << std::endl;
 			}
 		}
+		if (format == SPACE && type != OP)
+		{
+			dst << spiceStream.str();
+			spiceStream.str("");
+		}
+		else if (format == CSV && type != OP)
+		{
+			dst << csvStream.str();
+			csvStream.str("");
+		}
 	}
 };
 
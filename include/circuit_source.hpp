@@ -26,9 +26,17 @@ protected:
 	}
 
 public:
+	double getSineAmplitude() const
+	{
+		return SINE_amplitude;
+	}
+	double getSineFrequency() const
+	{
+		return SINE_frequency;
+	}
 	double getSourceOutput(ParamTable *param, double t) const
 	{
-		return (DC + SINE_DC_offset + (SINE_amplitude)*std::sin(2.0 * M_PI * SINE_frequency * t));
+		return ((variableDefined ? getValue(param) : DC) + SINE_DC_offset + (SINE_amplitude)*std::sin(2.0 * M_PI * SINE_frequency * t));
 	}
 	bool isSource() const override
 	{
@@ -135,7 +143,8 @@ public:
 				}
 				else
 				{
-					subCurrent = comp->getCurrent(param, t, timestep);
+					current -= comp->getNodeCurrent(refNode, param, t, timestep);
+					continue;
 				}
 
 				if (refNode == comp->getPosNode())
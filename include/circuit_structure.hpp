@@ -3,12 +3,14 @@
 
 #include <vector>
 #include <map>
+#include <set>
 #include <string>
 #include <cassert>
 #include <iostream>
 #include <functional>
 #include <algorithm>
 #include <typeinfo>
+#include <random>
 
 namespace Circuit
 {
@@ -28,7 +30,26 @@ namespace Circuit
 	class Math;
 	class LC;
 	class Diode;
+	class ExpIntegrator;
+	class Macromodel;
+	class Reduction;
+	class BlockSolver;
+	class IterativeSolver;
+	class ParallelLU;
+	class ThreadPool;
+	class LaneLU;
+	class DiodeBank;
+	class Newton;
+	class OperatingPoint;
+	class LowRankSolver;
+	class Topology;
+	class Scheduler;
+	class MonteCarlo;
+	class Shards;
+	class Analyses;
 	struct ParamTable;
+	class Sweep;
+	struct EliminatedNode;
 } // namespace Circuit
 
 struct Circuit::ParamTable
@@ -36,6 +57,169 @@ struct Circuit::ParamTable
 	std::map<std::string, double> lookup;
 };
 
+// the runs of the .step commands, every combination of the values of the
+// stepped variables with the last variable changing fastest, each repeated for
+// the trials of a .mc analysis. Runs are built on demand from their index, so
+// only the value lists and tolerances are stored and any run can be picked out
+// on its own
+class Circuit::Sweep
+{
+public:
+	// a component value varied by .tol, nominal * (1 + lot + device) where
+	// the lot deviation is shared by the components of one .tol command
+	struct Tolerance
+	{
+		std::string variable;
+		double nominal;
+		double device;
+		double lot;
+		bool gaussian; // tolerance is 3 sigma, otherwise the uniform half width
+		int lotGroup;
+	};
+
+private:
+	std::vector<std::pair<std::string, std::vector<double>>> variables;
+	std::vector<Tolerance> tolerances;
+	size_t trialCount = 0;
+	unsigned long seed = 1;
+	int lotGroups = 0;
+	bool sharded = false;
+	size_t first = 0; // runs [first, last) of all the runs, see setShard
+	size_t last = 0;
+
+	static double draw(std::mt19937_64 &rng, double tolerance, bool gaussian)
+	{
+		if (tolerance == 0)
+		{
+			return 0;
+		}
+		if (gaussian)
+		{
+			return std::normal_distribution<double>(0, tolerance / 3)(rng);
+		}
+		return std::uniform_real_distribution<double>(-tolerance, tolerance)(rng);
+	}
+
+public:
+	void addVariable(const std::string &name, const std::vector<double> &values)
+	{
+		variables.push_back(std::make_pair(name, values));
+	}
+	void setTrials(size_t trials, unsigned long seed)
+	{
+		trialCount = trials;
+		this->seed = seed;
+	}
+	// returns the lot group for the components of the next .tol command
+	int addLot()
+	{
+		return lotGroups++;
+	}
+	void addTolerance(const Tolerance &tolerance)
+	{
+		tolerances.push_back(tolerance);
+	}
+	// number of .mc trials, 0 without .mc
+	size_t trials() const
+	{
+		return trialCount;
+	}
+	unsigned long getSeed() const
+	{
+		return seed;
+	}
+	// number of combinations of the .step variables
+	size_t points() const
+	{
+		size_t runs = 1;
+		for (const std::pair<std::string, std::vector<double>> &var : variables)
+		{
+			runs *= var.second.size();
+		}
+		return runs;
+	}
+	// number of runs of the whole sweep, a circuit without .step or .mc has a
+	// single run
+	size_t total() const
+	{
+		return points() * std::max<size_t>(trialCount, 1);
+	}
+	// keeps shard i of n, a contiguous share of the runs, for a process that
+	// only simulates its part of the sweep
+	void setShard(size_t i, size_t n)
+	{
+		sharded = true;
+		first = i * total() / n;
+		last = (i + 1) * total() / n;
+	}
+	// number of runs to simulate
+	size_t size() const
+	{
+		return sharded ? last - first : total();
+	}
+	// index of run among all the runs of the sweep
+	size_t number(size_t run) const
+	{
+		return first + run;
+	}
+	// the .step values of point
+	void fillPoint(size_t point, ParamTable &param) const
+	{
+		for (size_t v = variables.size(); v-- > 0;)
+		{
+			const std::vector<double> &values = variables[v].second;
+			param.lookup[variables[v].first] = values[point % values.size()];
+			point /= values.size();
+		}
+	}
+	// The values of trial come from a generator seeded by the seed and the
+	// trial alone, so a trial draws the same values whichever thread or
+	// process runs it and in whatever order.
+	void fillTrial(size_t trial, ParamTable &param) const
+	{
+		std::seed_seq sequence{(unsigned int)seed, (unsigned int)(seed >> 32), (unsigned int)trial, (unsigned int)((unsigned long long)trial >> 32)};
+		std::mt19937_64 rng(sequence);
+		std::vector<double> lots(lotGroups);
+		std::vector<bool> drawn(lotGroups, false);
+		for (const Tolerance &tol : tolerances)
+		{
+			if (!drawn[tol.lotGroup])
+			{
+				lots[tol.lotGroup] = draw(rng, tol.lot, tol.gaussian);
+				drawn[tol.lotGroup] = true;
+			}
+		}
+		for (const Tolerance &tol : tolerances)
+		{
+			param.lookup[tol.variable] = tol.nominal * (1 + lots[tol.lotGroup] + draw(rng, tol.device, tol.gaussian));
+		}
+	}
+	void fill(size_t run, ParamTable &param) const
+	{
+		run = number(run);
+		if (trialCount > 0)
+		{
+			fillTrial(run % trialCount, param);
+			run /= trialCount;
+		}
+		fillPoint(run, param);
+	}
+	ParamTable operator[](size_t run) const
+	{
+		ParamTable param;
+		fill(run, param);
+		return param;
+	}
+};
+
+// a node removed by Reduction::simplify, its voltage is the weighted sum of the
+// voltages of the nodes it was connected to
+struct Circuit::EliminatedNode
+{
+	std::vector<std::pair<std::string, double>> weights;
+	double voltage = 0.0;
+};
+
 class Circuit::Schematic
 {
 	friend class Simulator;
@@ -48,7 +232,7 @@ public:
 	};
 
 private:
-	IterationType itType = Levenberg;
+	IterationType itType = Newton;
 	bool nonLinear = false;
 	std::function<int()> createIDGenerator(int &start) const
 	{
@@ -61,26 +245,42 @@ private:
 
 public:
 	Schematic();
-	std::vector<ParamTable *> tables;
+	Sweep sweep;
 	std::function<int()> id;
 	std::string title;
+	std::string netlist; // the text it was parsed from, for Scheduler to parse copies
 	std::map<std::string, Node *> nodes;
 	std::map<std::string, Component *> comps;
 	std::vector<std::string> commands;
 	std::vector<std::string> simulationCommands;
 	std::vector<Simulator *> sims;
 	std::vector<Diode *> nonLinearComps;
+	std::vector<Component *> macromodels; // reduced multiport models, see Macromodel
+	std::set<std::string> probes;
+	std::map<std::string, double> options;
+	std::map<std::string, EliminatedNode> eliminated;
+	std::vector<std::string> eliminationOrder;
+	std::vector<Node *> shunts; // nodes Topology::check gave a path to ground
+	double getOption(const std::string &name, double fallback) const
+	{
+		std::map<std::string, double>::const_iterator it = options.find(name);
+		return it != options.end() ? it->second : fallback;
+	}
 	void containsNonLinearComponents()
 	{
 		nonLinear = true;
 	}
 	void setupConnections2Node(Circuit::Component *linear, const std::string &nodeA, const std::string &nodeB);
 	void setupConnections3Node(Circuit::Component *linear, const std::string &nodeA, const std::string &nodeB, const std::string &nodeC);
+	void renumberNodes();
+	void reconstructVoltages();
 	~Schematic();
 };
 
 class Circuit::Node
 {
+	friend class Schematic;
+
 private:
 	Schematic *schem;
 	std::string name;
@@ -148,6 +348,12 @@ public:
 	{
 		return getVoltage() * getConductance(param, time);
 	}
+	// current flowing out of node n into this component
+	virtual double getNodeCurrent(const Node *n, ParamTable *param, double time, double timestep) const
+	{
+		double current = getCurrent(param, time, timestep);
+		return n == getPosNode() ? current : -current;
+	}
 
 	virtual ~Component()
 	{
@@ -192,10 +398,33 @@ public:
 			param->lookup[variableName] = value;
 		}
 	}
+	// the value given in the netlist, for components that take no variable
+	double getFixedValue() const
+	{
+		return value;
+	}
+	void setFixedValue(double value)
+	{
+		this->value = value;
+	}
 	virtual bool isSource() const
 	{
 		return false;
 	}
+	bool isVariableDefined() const
+	{
+		return variableDefined;
+	}
+	std::string getVariableName() const
+	{
+		return variableName;
+	}
+	// takes the value from a .step variable or a .tol deviation instead
+	void setVariable(const std::string &variableName)
+	{
+		this->variableDefined = true;
+		this->variableName = variableName;
+	}
 };
 
 void Circuit::Schematic::setupConnectionNode(Circuit::Component *linear, const std::string &node)
@@ -231,6 +460,45 @@ void Circuit::Schematic::setupConnections3Node(Circuit::Component *linear, const
 	setupConnectionNode(linear, nodeC);
 }
 
+// Reassigns node ids densely (ground stays -1) keeping their relative order,
+// needed after a pass removes nodes from the schematic.
+void Circuit::Schematic::renumberNodes()
+{
+	std::vector<Node *> ordered;
+	for (std::pair<std::string, Node *> node_pair : nodes)
+	{
+		if (node_pair.second->id != -1)
+		{
+			ordered.push_back(node_pair.second);
+		}
+	}
+	std::sort(ordered.begin(), ordered.end(), [](Node *a, Node *b) {
+		return a->id < b->id;
+	});
+	start = 0;
+	for (Node *n : ordered)
+	{
+		n->id = id();
+	}
+}
+
+// Recomputes the voltages of eliminated nodes from the present node voltages.
+// Nodes are restored in reverse order of elimination since a node can refer to
+// neighbours that were eliminated after it.
+void Circuit::Schematic::reconstructVoltages()
+{
+	for (std::vector<std::string>::reverse_iterator it = eliminationOrder.rbegin(); it != eliminationOrder.rend(); it++)
+	{
+		EliminatedNode &e = eliminated.at(*it);
+		e.voltage = 0.0;
+		for (std::pair<std::string, double> w : e.weights)
+		{
+			std::map<std::string, Node *>::iterator n = nodes.find(w.first);
+			e.voltage += w.second * (n != nodes.end() ? n->second->voltage : eliminated.at(w.first).voltage);
+		}
+	}
+}
+
 Circuit::Schematic::Schematic() : id(createIDGenerator(start))
 {
 	Node *ground = new Node("0", this);
@@ -239,16 +507,15 @@ Circuit::Schematic::Schematic() : id(createIDGenerator(start))
 
 Circuit::Schematic::~Schematic()
 {
-	std::for_each(tables.begin(), tables.end(),
-				  [](ParamTable *&t) {
-					  delete t;
-				  });
-
 	while (comps.size() != 0)
 	{
 		delete comps.begin()->second;
 	}
 
+	std::for_each(macromodels.begin(), macromodels.end(), [](Component *m) {
+		delete m;
+	});
+
 	std::for_each(sims.begin(), sims.end(), [](auto kv) {
 		delete kv;
 	});
@@ -0,0 +1,105 @@
+#ifndef GUARD_CIRCUIT_THREAD_POOL_HPP
+#define GUARD_CIRCUIT_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Threads that wait between solves for the next piece of work, so a transient
+// does not start threads for every level or leaf of every timestep. They are
+// started on the first call that needs them and joined with the pool.
+//
+// BlockSolver spreads the blocks of a level over the pool and the ParallelLU
+// of a large block its leaves. A run started from inside another one (a
+// ParallelLU block solved by a level worker) has no threads left to hand out
+// and runs its task on the calling thread alone.
+class Circuit::ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void()> *task = nullptr;
+    size_t generation = 0; // counts the tasks handed out
+    size_t helpers = 0;    // workers taking part in the current task
+    size_t busy = 0;
+    bool running = false;
+    bool stopping = false;
+
+    void work(size_t index, size_t seen)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true)
+        {
+            wake.wait(guard, [&]() { return stopping || generation != seen; });
+            if (stopping)
+            {
+                return;
+            }
+            seen = generation;
+            if (index >= helpers)
+            {
+                continue;
+            }
+            const std::function<void()> &current = *task;
+            guard.unlock();
+            current();
+            guard.lock();
+            if (--busy == 0)
+            {
+                finished.notify_one();
+            }
+        }
+    }
+
+public:
+    ThreadPool() = default;
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // runs task on threads threads, the calling one included, and returns
+    // once every copy has returned
+    void run(size_t threads, const std::function<void()> &task)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if (running || threads <= 1)
+        {
+            guard.unlock();
+            task();
+            return;
+        }
+        while (workers.size() + 1 < threads)
+        {
+            workers.emplace_back(&ThreadPool::work, this, workers.size(), generation);
+        }
+        this->task = &task;
+        helpers = threads - 1;
+        busy = helpers;
+        running = true;
+        generation++;
+        wake.notify_all();
+        guard.unlock();
+        task();
+        guard.lock();
+        finished.wait(guard, [&]() { return busy == 0; });
+        this->task = nullptr;
+        running = false;
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &t : workers)
+        {
+            t.join();
+        }
+    }
+};
+
+#endif
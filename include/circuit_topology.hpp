@@ -0,0 +1,138 @@
+#ifndef GUARD_CIRCUIT_TOPOLOGY_HPP
+#define GUARD_CIRCUIT_TOPOLOGY_HPP
+
+#include <numeric>
+
+// Checks the netlist graph for structures that make every MNA matrix
+// singular, before anything is factorised:
+//  - loops made only of voltage sources, which over-determine the branch
+//    voltages, are rejected
+//  - islands of nodes with no DC path to ground, i.e. joined to the rest only
+//    through capacitors and current sources, get a shunt conductance of
+//    gshunt from one of their nodes to ground. An island fed by a current
+//    source is a current source cutset and is reported as such.
+// Inductors are shorts at DC, so loops of inductors and voltage sources only
+// make the operating point singular; they are reported but not rejected.
+class Circuit::Topology
+{
+private:
+    static int findRoot(std::vector<int> &parent, int i)
+    {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    // joins a and b, false if they were already connected
+    static bool join(std::vector<int> &parent, int a, int b)
+    {
+        a = findRoot(parent, a);
+        b = findRoot(parent, b);
+        if (a == b)
+        {
+            return false;
+        }
+        parent[a] = b;
+        return true;
+    }
+
+    // union-find index of a node, ground is 0
+    static int indexOf(const Node *node)
+    {
+        return node->getId() + 1;
+    }
+
+public:
+    // Returns false if the circuit cannot be simulated. Shunted nodes are
+    // added to schem->shunts and what was found is reported to reports.
+    static bool check(Schematic *schem, std::ostream &reports = std::cerr);
+};
+
+bool Circuit::Topology::check(Schematic *schem, std::ostream &reports)
+{
+    const int n = schem->nodes.size();
+    std::vector<int> sourceLoops(n), dc(n);
+    std::iota(sourceLoops.begin(), sourceLoops.end(), 0);
+    std::iota(dc.begin(), dc.end(), 0);
+    bool ok = true;
+
+    // voltage sources first so a loop is blamed on the source closing it,
+    // then inductors, which close the loops that are only singular at DC
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        if (dynamic_cast<Voltage *>(comp.second) &&
+            !join(sourceLoops, indexOf(comp.second->getPosNode()), indexOf(comp.second->getNegNode())))
+        {
+            reports << "voltage source " << comp.first << " closes a loop of voltage sources between nodes "
+                      << comp.second->getPosNode()->getName() << " and " << comp.second->getNegNode()->getName() << std::endl;
+            ok = false;
+        }
+    }
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        if (dynamic_cast<Inductor *>(comp.second) &&
+            !join(sourceLoops, indexOf(comp.second->getPosNode()), indexOf(comp.second->getNegNode())))
+        {
+            reports << "inductor " << comp.first << " closes a loop of inductors and voltage sources, "
+                      << "the DC operating point is singular" << std::endl;
+        }
+    }
+    if (!ok)
+    {
+        return false;
+    }
+
+    // everything but capacitors and current sources conducts at DC
+    for (std::pair<std::string, Component *> comp : schem->comps)
+    {
+        if (dynamic_cast<Capacitor *>(comp.second) || dynamic_cast<Current *>(comp.second))
+        {
+            continue;
+        }
+        for (Node *node : comp.second->nodes)
+        {
+            join(dc, indexOf(comp.second->getPosNode()), indexOf(node));
+        }
+    }
+    for (Component *comp : schem->macromodels)
+    {
+        for (Node *node : comp->nodes)
+        {
+            join(dc, indexOf(comp->nodes[0]), indexOf(node));
+        }
+    }
+
+    // one shunt per island, on its first node by name
+    std::map<int, std::vector<Node *>> islands;
+    for (std::pair<std::string, Node *> node : schem->nodes)
+    {
+        if (findRoot(dc, indexOf(node.second)) != findRoot(dc, 0))
+        {
+            islands[findRoot(dc, indexOf(node.second))].push_back(node.second);
+        }
+    }
+    for (std::pair<const int, std::vector<Node *>> &island : islands)
+    {
+        bool fed = false;
+        for (Node *node : island.second)
+        {
+            for (Component *comp : node->comps)
+            {
+                fed = fed || dynamic_cast<Current *>(comp);
+            }
+        }
+        reports << (fed ? "current sources cut off" : "no DC path to ground from") << " node";
+        for (Node *node : island.second)
+        {
+            reports << " " << node->getName();
+        }
+        reports << ", adding a shunt to ground at " << island.second.front()->getName() << std::endl;
+        schem->shunts.push_back(island.second.front());
+    }
+    return true;
+}
+
+#endif
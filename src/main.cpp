@@ -12,16 +12,21 @@ std::string showHelp()
         "-f\t\t<format>\tspecify output format, either csv or space\n"
         "-p\t\t<list>\t\tplots output, space separated list specifies columns to plot\n"
         "-s\t\t<path>\t\tsaves graph output as html at specified location, requires -p\n"
+        "-l\t\t<solver>\tlinear solver, either direct, iterative or auto (default)\n"
         "-c\t\t\t\tshows names of columns in output file, blocks -p and -s i.e. doesn't plot/save result\n"
-        "-h\t\t\t\tshows this help information\n\n"
-        "Usage: simulator -i file [ -ch ] [ -o dir ] [-p list] [ -s path ] [ -f format ]\n\n"
+        "-h\t\t\t\tshows this help information\n"
+        "--shard\t\t<i/n>\t\tsimulates only shard i of n of the sweep, into files ending in _shard<i>of<n>\n"
+        "--shards\t<n>\t\tsimulates the sweep in n processes and merges their output\n\n"
+        "Usage: simulator -i file [ -ch ] [ -o dir ] [-p list] [ -s path ] [ -f format ] [ -l solver ] [ --shard i/n | --shards n ]\n\n"
         "Examples:\n\n"
         "Plot Specific Columns:\n"
         "\tsimulator -i test.net -p 'V(N001) V(N002)'\n\n"
         "Plot All Columns and save result as interactive HTML:\n"
         "\tsimulator -i test.net -p '' -s result.html\n\n"
         "Generate result and check names of columns in netlist:\n"
-        "\tsimulator -i test.net -c\n";
+        "\tsimulator -i test.net -c\n\n"
+        "Simulate a .step sweep in 4 processes:\n"
+        "\tsimulator -i test.net --shards 4\n";
 
 
     return helpMessage;
@@ -32,7 +37,11 @@ int main(int argc, char *argv[])
     int c;
     std::map<std::string, std::string> stringFlags;
     std::map<std::string, bool> boolFlags;
-    while ((c = getopt(argc, argv, "cf:hi:o:p:s:")) != -1)
+    const option longOptions[] = {
+        {"shard", required_argument, nullptr, 'S'},
+        {"shards", required_argument, nullptr, 'N'},
+        {nullptr, 0, nullptr, 0}};
+    while ((c = getopt_long(argc, argv, "cf:hi:l:o:p:s:", longOptions, nullptr)) != -1)
     {
         switch (c)
         {
@@ -48,6 +57,9 @@ int main(int argc, char *argv[])
         case 'i':
             stringFlags["inputFilePath"] = optarg;
             break;
+        case 'l':
+            stringFlags["linearSolver"] = optarg;
+            break;
         case 'o':
             stringFlags["outputFolderPath"] = optarg;
             break;
@@ -58,6 +70,12 @@ int main(int argc, char *argv[])
         case 's':
             stringFlags["saveHtmlOutput"] = optarg;
             break;
+        case 'S':
+            stringFlags["shard"] = optarg;
+            break;
+        case 'N':
+            stringFlags["shards"] = optarg;
+            break;
         default:
             std::cerr << "Unknown Flag: '" << c << "'\n";
             exit(1);
@@ -83,6 +101,51 @@ int main(int argc, char *argv[])
 
     Circuit::Schematic *schem = Circuit::Parser::parse(inputFile);
     inputFile.close();
+    Circuit::Reduction::run(schem);
+    if (!Circuit::Topology::check(schem))
+    {
+        exit(1);
+    }
+    Circuit::Math::setThreads(schem->getOption("threads", std::thread::hardware_concurrency()));
+    Circuit::Diode::setBypass(schem->getOption("bypass", 1) != 0 ? schem->getOption("bypasstol", schem->getOption("vntol", 1e-6)) : -1);
+
+    Circuit::BlockSolver::Method linearSolver = Circuit::BlockSolver::Method::Auto;
+    if (!stringFlags["linearSolver"].empty() && tolower(stringFlags["linearSolver"][0]) == 'd')
+    {
+        linearSolver = Circuit::BlockSolver::Method::Direct;
+    }
+    else if (!stringFlags["linearSolver"].empty() && tolower(stringFlags["linearSolver"][0]) == 'i')
+    {
+        linearSolver = Circuit::BlockSolver::Method::Iterative;
+    }
+    Circuit::Math::setLinearSolver(linearSolver, schem->getOption("itertol", 1e-10), schem->getOption("iterminsize", 20000), schem->getOption("parminsize", 5000));
+    Circuit::Math::setSparseAssembly(schem->getOption("sparseminsize", 17));
+    Circuit::Math::setEquilibration(schem->getOption("equilibrate", 1) != 0);
+    Circuit::Math::setMixedPrecision(schem->getOption("mixedprecision", 0) != 0);
+
+    // --shard i/n runs only part of the sweep, --shards n all of it in n processes
+    unsigned long shard = 0, shards = 1;
+    std::string shardSuffix;
+    if (!stringFlags["shard"].empty())
+    {
+        if (sscanf(stringFlags["shard"].c_str(), "%lu/%lu", &shard, &shards) != 2 || shards == 0 || shard >= shards)
+        {
+            std::cerr << "--shard expects i/n with 0 <= i < n, got '" << stringFlags["shard"] << "'" << std::endl;
+            exit(1);
+        }
+        schem->sweep.setShard(shard, shards);
+        shardSuffix = "_shard" + std::to_string(shard) + "of" + std::to_string(shards);
+        shards = 1;
+    }
+    else if (!stringFlags["shards"].empty())
+    {
+        shards = strtoul(stringFlags["shards"].c_str(), nullptr, 10);
+        if (shards == 0)
+        {
+            std::cerr << "--shards expects a number of processes, got '" << stringFlags["shards"] << "'" << std::endl;
+            exit(1);
+        }
+    }
 
     if (stringFlags["outputFolderPath"].empty())
     {
@@ -90,7 +153,6 @@ int main(int argc, char *argv[])
     }
 
     std::filesystem::create_directory(stringFlags["outputFolderPath"]);
-    std::ofstream out;
     std::string outputPath;
     Circuit::Simulator::OutputFormat outputFormat;
 
@@ -103,9 +165,10 @@ int main(int argc, char *argv[])
         outputFormat = Circuit::Simulator::OutputFormat::SPACE;
     }
 
+    std::vector<std::string> outputPaths;
     for (Circuit::Simulator *sim : schem->sims)
     {
-        outputPath = stringFlags["outputFolderPath"] + "/" + schem->title.substr(2) + sim->simulationTypeMap[sim->type];
+        outputPath = stringFlags["outputFolderPath"] + "/" + schem->title.substr(2) + sim->simulationTypeMap[sim->type] + shardSuffix;
         if (outputFormat == Circuit::Simulator::OutputFormat::CSV && sim->type != Circuit::Simulator::SimulationType::OP)
         {
             outputPath += ".csv";
@@ -114,9 +177,22 @@ int main(int argc, char *argv[])
         {
             outputPath += ".txt";
         }
-        out.open(outputPath);
-        sim->run(out, outputFormat);
-        out.close();
+        outputPaths.push_back(outputPath);
+    }
+
+    int status = 0;
+    if (shards > 1)
+    {
+        status = Circuit::Shards::coordinate(schem, shards, outputPaths, outputFormat) ? 0 : 1;
+    }
+    else
+    {
+        Circuit::Analyses::run(schem, outputPaths, outputFormat);
+    }
+    for (size_t s = 0; s < schem->sims.size(); s++)
+    {
+        Circuit::Simulator *sim = schem->sims[s];
+        outputPath = outputPaths[s];
 
         std::string systemCall = "simulatorplot ";
 
@@ -143,5 +219,5 @@ int main(int argc, char *argv[])
         }
     }
     delete schem;
-    return 0;
+    return status;
 }
@@ -0,0 +1,155 @@
+#include <hayai.hpp>
+#include <circuit.hpp>
+#include <vector>
+
+// Double against mixed precision direct solves of linear transient matrices:
+// the RC ladder of RC_test stretched to many sections, and a power grid mesh
+// fed through voltage source pads. One iteration factorises the matrix and
+// solves a right hand side per timestep, as a fixed step transient does.
+
+const int STEPS = 100;
+
+// backward Euler companion of an RC network at a 10us step
+void addBranch(std::vector<Eigen::Triplet<double>> &t, int a, int b, double g)
+{
+    if (a != -1)
+        t.emplace_back(a, a, g);
+    if (b != -1)
+        t.emplace_back(b, b, g);
+    if (a != -1 && b != -1)
+    {
+        t.emplace_back(a, b, -g);
+        t.emplace_back(b, a, -g);
+    }
+}
+
+// a voltage source from node a to ground replaces its KCL row
+void pin(Eigen::SparseMatrix<double> &A, int a)
+{
+    A.prune([a](int row, int, double) { return row != a; });
+    A.coeffRef(a, a) = 1.0;
+    A.makeCompressed();
+}
+
+Eigen::SparseMatrix<double> ladder(int sections)
+{
+    std::vector<Eigen::Triplet<double>> t;
+    for (int k = 0; k < sections; k++)
+    {
+        addBranch(t, k, k + 1 < sections ? k + 1 : -1, 1.0 / 100);
+        addBranch(t, k, -1, 10e-6 / 10e-6);
+    }
+    Eigen::SparseMatrix<double> A(sections, sections);
+    A.setFromTriplets(t.begin(), t.end());
+    pin(A, 0);
+    return A;
+}
+
+Eigen::SparseMatrix<double> mesh(int side)
+{
+    std::vector<Eigen::Triplet<double>> t;
+    for (int i = 0; i < side; i++)
+    {
+        for (int j = 0; j < side; j++)
+        {
+            int k = i * side + j;
+            if (j + 1 < side)
+                addBranch(t, k, k + 1, 1e3);
+            if (i + 1 < side)
+                addBranch(t, k, k + side, 1e3);
+            addBranch(t, k, -1, 1e-9 / 10e-6);
+        }
+    }
+    Eigen::SparseMatrix<double> A(side * side, side * side);
+    A.setFromTriplets(t.begin(), t.end());
+    for (int k = 0; k < side * side; k += 16 * side + 16)
+    {
+        pin(A, k);
+    }
+    return A;
+}
+
+template <bool MIXED>
+class SolveFixture : public ::hayai::Fixture
+{
+public:
+    virtual void SetUp()
+    {
+        solver.setThreads(1);
+        solver.setMethod(Circuit::BlockSolver::Method::Direct, 1e-10, 1 << 30, 1 << 30);
+        solver.setMixedPrecision(MIXED);
+        rhs = Eigen::MatrixXd::Random(ladderMatrix.rows(), STEPS);
+        meshRhs = Eigen::MatrixXd::Random(meshMatrix.rows(), STEPS);
+    }
+
+    void run(const Eigen::SparseMatrix<double> &A, const Eigen::MatrixXd &b)
+    {
+        // scaled a little differently every run so the solver sees new values
+        // and factorises again
+        Eigen::SparseMatrix<double> M = A * (1.0 + 1e-12 * ++generation);
+        for (int k = 0; k < STEPS; k++)
+        {
+            current = b.col(k);
+            solver.solve(M, current, voltage);
+        }
+    }
+
+    static Eigen::SparseMatrix<double> ladderMatrix;
+    static Eigen::SparseMatrix<double> meshMatrix;
+    Circuit::BlockSolver solver;
+    int generation = 0;
+    Eigen::MatrixXd rhs;
+    Eigen::MatrixXd meshRhs;
+    Eigen::VectorXd current;
+    Eigen::VectorXd voltage;
+};
+
+template <bool MIXED>
+Eigen::SparseMatrix<double> SolveFixture<MIXED>::ladderMatrix = ladder(100000);
+template <bool MIXED>
+Eigen::SparseMatrix<double> SolveFixture<MIXED>::meshMatrix = mesh(300);
+
+typedef SolveFixture<false> DoubleFixture;
+typedef SolveFixture<true> MixedFixture;
+
+BENCHMARK_F(DoubleFixture, ladder, 10, 1)
+{
+    run(ladderMatrix, rhs);
+}
+
+BENCHMARK_F(MixedFixture, ladder, 10, 1)
+{
+    run(ladderMatrix, rhs);
+}
+
+BENCHMARK_F(DoubleFixture, mesh, 10, 1)
+{
+    run(meshMatrix, meshRhs);
+}
+
+BENCHMARK_F(MixedFixture, mesh, 10, 1)
+{
+    run(meshMatrix, meshRhs);
+}
+
+int main(int argc, char const *argv[])
+{
+    // refined solutions against the double ones
+    for (const Eigen::SparseMatrix<double> *A : {&DoubleFixture::ladderMatrix, &DoubleFixture::meshMatrix})
+    {
+        Circuit::BlockSolver full, mixed;
+        full.setMethod(Circuit::BlockSolver::Method::Direct, 1e-10, 1 << 30, 1 << 30);
+        mixed.setMethod(Circuit::BlockSolver::Method::Direct, 1e-10, 1 << 30, 1 << 30);
+        mixed.setMixedPrecision(true);
+        Eigen::VectorXd b = Eigen::VectorXd::Random(A->rows()), x, y;
+        full.solve(*A, b, x);
+        mixed.solve(*A, b, y);
+        std::cout << A->rows() << " unknowns: relative difference " << (x - y).norm() / x.norm()
+                  << ", residual " << (*A * y - b).norm() / b.norm() << std::endl;
+    }
+
+    hayai::ConsoleOutputter consoleOutputter;
+    hayai::Benchmarker::AddOutputter(consoleOutputter);
+    hayai::Benchmarker::RunAllTests();
+    return 0;
+}